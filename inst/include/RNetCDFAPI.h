@@ -0,0 +1,224 @@
+/*=============================================================================*\
+ *
+ *  Name:       RNetCDFAPI.h
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    C interface of RNetCDF for native code in other packages
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ *
+ *  Usage: add "LinkingTo: RNetCDF" and "Imports: RNetCDF" to the DESCRIPTION
+ *  of a package, and include this header in its native code. The functions
+ *  are found with R_GetCCallable when they are first called, so RNetCDF must
+ *  be loaded (e.g. by importing any function from its namespace).
+ *
+ *  The interface is versioned by RNETCDF_API_VERSION. Functions and the
+ *  layout of R_nc_buf are only changed when the version is incremented.
+ *  Code compiled against this header can check the version of the installed
+ *  package with RNetCDF_api_version.
+ *
+ *  Errors in all functions are raised as R errors.
+ *  Memory for C buffers is allocated by R_alloc, so it is freed when the
+ *  calling .Call routine returns.
+ *
+ *=============================================================================*
+ */
+
+#ifndef RNETCDF_API_H_INCLUDED
+#define RNETCDF_API_H_INCLUDED
+
+#include <stddef.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+
+#include <netcdf.h>
+
+#define RNETCDF_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* State of a conversion from C to R, used by RNetCDF_c2r_init and
+   RNetCDF_c2r. Other functions should not access members directly.
+ */
+typedef struct {
+  SEXP rxp;
+  void *cbuf, *rbuf;
+  nc_type xtype;
+  int ncid, ndim, rawchar, fitnum;
+  size_t *xdim;
+  void *fill, *min, *max;
+  double *scale, *add;
+  } R_nc_buf;
+
+
+#ifndef RNETCDF_API_INTERNAL
+
+#define RNETCDF_API_FUN(NAME) R_GetCCallable ("RNetCDF", NAME)
+
+/* Version of the interface provided by the installed package.
+ */
+static inline int
+RNetCDF_api_version (void)
+{
+  static int (*fun) (void) = NULL;
+  if (!fun) {
+    fun = (int (*) (void)) RNETCDF_API_FUN ("R_nc_api_version");
+  }
+  return fun ();
+}
+
+
+/* Read a region of a netcdf variable and convert it to R,
+   as by var.get.nc. Arguments start and count give the region in C order
+   (NULL for scalars), and the remaining arguments have the meanings
+   described for var.get.nc (na.mode is namode).
+   The result is not protected.
+ */
+static inline SEXP
+RNetCDF_read_region (int ncid, int varid, const size_t *start,
+                     const size_t *count, int rawchar, int fitnum,
+                     int namode, int unpack)
+{
+  static SEXP (*fun) (int, int, const size_t *, const size_t *,
+                      int, int, int, int) = NULL;
+  if (!fun) {
+    fun = (SEXP (*) (int, int, const size_t *, const size_t *,
+                     int, int, int, int)) RNETCDF_API_FUN ("R_nc_read_region");
+  }
+  return fun (ncid, varid, start, count, rawchar, fitnum, namode, unpack);
+}
+
+
+/* Find attributes for missing values of a netcdf variable.
+   On exit, fill, min and max are either NULL or point to values of the
+   external type of the variable. Argument mode is na.mode of var.get.nc.
+ */
+static inline void
+RNetCDF_miss_att (int ncid, int varid, int mode,
+                  void **fill, void **min, void **max)
+{
+  static void (*fun) (int, int, int, void **, void **, void **) = NULL;
+  if (!fun) {
+    fun = (void (*) (int, int, int, void **, void **, void **))
+          RNETCDF_API_FUN ("R_nc_miss_att");
+  }
+  fun (ncid, varid, mode, fill, min, max);
+}
+
+
+/* Find packing attributes of a netcdf variable.
+   On entry, *scale and *add must point to storage for the attributes.
+   On exit, each pointer is set to NULL if the attribute is not defined.
+ */
+static inline void
+RNetCDF_pack_att (int ncid, int varid, double **scale, double **add)
+{
+  static void (*fun) (int, int, double **, double **) = NULL;
+  if (!fun) {
+    fun = (void (*) (int, int, double **, double **))
+          RNETCDF_API_FUN ("R_nc_pack_att");
+  }
+  fun (ncid, varid, scale, add);
+}
+
+
+/* Prepare to convert an array of netcdf external type (xtype) to R.
+   The result is a pointer to the C buffer for netcdf functions, which is
+   cbuf if it is not NULL. The number and lengths of netcdf dimensions are
+   ndim and xdim (C order). Other arguments are as for RNetCDF_read_region;
+   fill, min, max, scale and add may be NULL, or found by RNetCDF_miss_att
+   and RNetCDF_pack_att.
+   The R array under construction is preserved (by R_PreserveObject) until
+   RNetCDF_c2r is called, so the protect stack of the caller is unchanged.
+   RNetCDF_c2r should be called before the calling .Call routine returns,
+   otherwise the R array is not released.
+ */
+static inline void *
+RNetCDF_c2r_init (R_nc_buf *io, void *cbuf,
+                  int ncid, nc_type xtype, int ndim, const size_t *xdim,
+                  int rawchar, int fitnum,
+                  const void *fill, const void *min, const void *max,
+                  const double *scale, const double *add)
+{
+  static void * (*fun) (R_nc_buf *, void *, int, nc_type, int,
+                        const size_t *, int, int, const void *,
+                        const void *, const void *, const double *,
+                        const double *) = NULL;
+  if (!fun) {
+    fun = (void * (*) (R_nc_buf *, void *, int, nc_type, int,
+                       const size_t *, int, int, const void *,
+                       const void *, const void *, const double *,
+                       const double *)) RNETCDF_API_FUN ("R_nc_c2r_init");
+  }
+  return fun (io, cbuf, ncid, xtype, ndim, xdim, rawchar, fitnum,
+              fill, min, max, scale, add);
+}
+
+
+/* Convert the C buffer prepared by RNetCDF_c2r_init to R.
+   The result is not protected.
+ */
+static inline SEXP
+RNetCDF_c2r (R_nc_buf *io)
+{
+  static SEXP (*fun) (R_nc_buf *) = NULL;
+  if (!fun) {
+    fun = (SEXP (*) (R_nc_buf *)) RNETCDF_API_FUN ("R_nc_c2r");
+  }
+  return fun (io);
+}
+
+
+/* Convert an R vector to a netcdf external type (xtype),
+   with the dimensions ndim and xdim (C order).
+   Missing values are replaced by fill (if not NULL), and values are packed
+   if scale or add are not NULL. The result may point to the data of rv.
+ */
+static inline const void *
+RNetCDF_r2c (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim,
+             const void *fill, const double *scale, const double *add)
+{
+  static const void * (*fun) (SEXP, int, nc_type, int, const size_t *,
+                              const void *, const double *,
+                              const double *) = NULL;
+  if (!fun) {
+    fun = (const void * (*) (SEXP, int, nc_type, int, const size_t *,
+                             const void *, const double *, const double *))
+          RNETCDF_API_FUN ("R_nc_r2c");
+  }
+  return fun (rv, ncid, xtype, ndim, xdim, fill, scale, add);
+}
+
+#endif /* RNETCDF_API_INTERNAL */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RNETCDF_API_H_INCLUDED */
@@ -34,6 +34,12 @@
 #define RNC_RNETCDF_H_INCLUDED
 
 
+/* C interface */
+
+SEXP
+R_nc_api_check (SEXP names);
+
+
 /* Attributes */
 
 SEXP
@@ -55,20 +61,49 @@ SEXP
 R_nc_rename_att (SEXP nc, SEXP var, SEXP att, SEXP newname);
 
 
+/* Benchmarks */
+
+SEXP
+R_nc_bench_convert (SEXP nc, SEXP var, SEXP data, SEXP rawchar,
+                    SEXP fitnum, SEXP namode, SEXP pack, SEXP reps);
+
+
 /* Datasets */
 
 SEXP
 R_nc_close (SEXP ptr);
 
+SEXP
+R_nc_copy_file (SEXP nc_in, SEXP nc_out, SEXP chunking, SEXP deflate,
+                SEXP shuffle, SEXP bufsize);
+
+SEXP
+R_nc_copy_schema (SEXP nc_in, SEXP nc_out, SEXP chunking, SEXP deflate,
+                  SEXP shuffle);
+
 SEXP
 R_nc_create (SEXP filename, SEXP clobber, SEXP share, SEXP prefill,
              SEXP format);
 
+SEXP
+R_nc_http_cache (SEXP memory, SEXP disk, SEXP dir, SEXP blocksize,
+                 SEXP reset);
+
 SEXP
 R_nc_inq_file (SEXP nc);
 
 SEXP
-R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill);
+R_nc_inq_stats (SEXP nc, SEXP reset);
+
+SEXP
+R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill,
+           SEXP threads, SEXP follow);
+
+SEXP
+R_nc_refresh (SEXP nc);
+
+SEXP
+R_nc_scan_header (SEXP filename);
 
 SEXP
 R_nc_sync (SEXP nc);
@@ -122,6 +157,15 @@ SEXP
 R_nc_rename_grp (SEXP nc, SEXP grpname);
 
 
+/* Tracing */
+
+SEXP
+R_nc_trace_start (SEXP maxspan);
+
+SEXP
+R_nc_trace_stop (void);
+
+
 /* Types */
 
 SEXP
@@ -150,21 +194,62 @@ R_nc_utterm ();
 /* Variables */
 
 SEXP
-R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims);
+R_nc_chunk_advise (SEXP nc, SEXP type, SEXP dims, SEXP access, SEXP target);
+
+SEXP
+R_nc_copy_var (SEXP nc_in, SEXP var_in, SEXP nc_out, SEXP name,
+               SEXP chunking, SEXP chunksizes, SEXP deflate, SEXP shuffle,
+               SEXP bufsize);
+
+SEXP
+R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims, SEXP quantize,
+              SEXP nsd, SEXP chunking, SEXP chunksizes, SEXP access);
 
 SEXP
 R_nc_get_var (SEXP nc, SEXP var, SEXP start, SEXP count,
               SEXP rawchar, SEXP fitnum, SEXP namode, SEXP unpack);
 
+SEXP
+R_nc_get_arrow (SEXP nc, SEXP var, SEXP start, SEXP count, SEXP namode);
+
+SEXP
+R_nc_get_ragged (SEXP nc, SEXP varids, SEXP ragged, SEXP instancedim,
+                 SEXP features, SEXP flat, SEXP fitnum, SEXP namode,
+                 SEXP unpack);
+
+SEXP
+R_nc_get_rec (SEXP nc, SEXP varids, SEXP start, SEXP count,
+              SEXP rawchar, SEXP fitnum, SEXP namode, SEXP unpack,
+              SEXP blocksize);
+
+SEXP
+R_nc_get_sparse (SEXP nc, SEXP var, SEXP start, SEXP count,
+                 SEXP fitnum, SEXP namode, SEXP unpack);
+
+SEXP
+R_nc_get_table (SEXP nc, SEXP dim, SEXP varids, SEXP start, SEXP count,
+                SEXP fitnum, SEXP namode, SEXP unpack, SEXP blocksize);
+
+SEXP
+R_nc_get_vlen_flat (SEXP nc, SEXP var, SEXP start, SEXP count,
+                    SEXP fitnum, SEXP namode, SEXP unpack);
+
 SEXP
 R_nc_inq_var (SEXP nc, SEXP var);
 
 SEXP
 R_nc_put_var (SEXP nc, SEXP var, SEXP start, SEXP count, SEXP data,
-              SEXP namode, SEXP pack);
+              SEXP namode, SEXP pack, SEXP bits);
+
+SEXP
+R_nc_put_vlen_flat (SEXP nc, SEXP var, SEXP start, SEXP count,
+                    SEXP values, SEXP offsets, SEXP namode, SEXP pack);
 
 SEXP
 R_nc_rename_var (SEXP nc, SEXP var, SEXP newname);
 
+SEXP
+R_nc_result_cache (SEXP size, SEXP dir, SEXP reset);
+
 
 #endif  /* RNC_RNETCDF_H_INCLUDED */
@@ -0,0 +1,198 @@
+/*=============================================================================*\
+ *
+ *  Name:       api.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    C interface of RNetCDF for native code in other packages
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stddef.h>
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "convert.h"
+#include "RNetCDF.h"
+
+
+/* Functions registered by R_RegisterCCallable are called from native code
+   in other packages, usually within their own .Call routines.
+   Objects protected by RNetCDF are unprotected before each function returns,
+   so that callers see a balanced protect stack. Memory allocated by R_alloc
+   is not released, because results may point to it, but it is no longer
+   counted as used by RNetCDF.
+ */
+
+static void
+R_nc_api_release (R_nc_mark mark)
+{
+  R_nc_release_protect (mark);
+  R_nc_alloc_used = mark.used;
+}
+
+static int
+R_nc_api_version (void)
+{
+  return RNETCDF_API_VERSION;
+}
+
+
+/* Prepare conversion from C to R.
+   The R array is preserved (rather than protected) until R_nc_api_c2r,
+   so that objects protected by the caller in the meantime are not affected.
+ */
+static void *
+R_nc_api_c2r_init (R_nc_buf *io, void *cbuf,
+                   int ncid, nc_type xtype, int ndim, const size_t *xdim,
+                   int rawchar, int fitnum,
+                   const void *fill, const void *min, const void *max,
+                   const double *scale, const double *add)
+{
+  R_nc_mark mark;
+  void *result;
+  mark = R_nc_mark_get ();
+  result = R_nc_c2r_init (io, cbuf, ncid, xtype, ndim, xdim, rawchar, fitnum,
+                          fill, min, max, scale, add);
+  R_PreserveObject (io->rxp);
+  R_nc_api_release (mark);
+  return result;
+}
+
+
+/* Complete conversion from C to R, releasing the R array.
+ */
+static SEXP
+R_nc_api_c2r (R_nc_buf *io)
+{
+  R_nc_mark mark;
+  SEXP result;
+  mark = R_nc_mark_get ();
+  result = R_nc_c2r (io);
+  R_nc_api_release (mark);
+  R_ReleaseObject (io->rxp);
+  return result;
+}
+
+
+static const void *
+R_nc_api_r2c (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim,
+              const void *fill, const double *scale, const double *add)
+{
+  R_nc_mark mark;
+  const void *result;
+  mark = R_nc_mark_get ();
+  result = R_nc_r2c (rv, ncid, xtype, ndim, xdim, fill, scale, add);
+  R_nc_api_release (mark);
+  return result;
+}
+
+
+/* Read a region of a variable, as R_nc_get_var but with arguments in C.
+   Start and count are in C order, and they are ignored for scalars.
+ */
+static SEXP
+R_nc_read_region (int ncid, int varid, const size_t *start,
+                  const size_t *count, int rawchar, int fitnum,
+                  int namode, int unpack)
+{
+  int ndims;
+  nc_type xtype;
+  void *buf;
+  R_nc_buf io;
+  R_nc_mark mark;
+  double add, scale, *addp=NULL, *scalep=NULL;
+  void *fillp=NULL, *minp=NULL, *maxp=NULL;
+  SEXP result;
+
+  mark = R_nc_mark_get ();
+
+  R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
+  if (ndims > 0 && (!start || !count)) {
+    R_nc_error ("Start and count are required for an array");
+  }
+
+  R_nc_miss_att (ncid, varid, namode, &fillp, &minp, &maxp);
+  if (unpack) {
+    scalep = &scale;
+    addp = &add;
+    R_nc_pack_att (ncid, varid, &scalep, &addp);
+  }
+
+  R_nc_check (R_nc_enddef (ncid));
+
+  buf = R_nc_c2r_init (&io, NULL, ncid, xtype, ndims, count,
+                       rawchar, fitnum, fillp, minp, maxp, scalep, addp);
+  if (R_nc_length (ndims, count) > 0) {
+    R_nc_check (nc_get_vara (ncid, varid, start, count, buf));
+  }
+  result = R_nc_c2r (&io);
+
+  R_nc_api_release (mark);
+  return result;
+}
+
+
+void
+R_nc_api_init (void)
+{
+  R_RegisterCCallable ("RNetCDF", "R_nc_api_version",
+                       (DL_FUNC) &R_nc_api_version);
+  R_RegisterCCallable ("RNetCDF", "R_nc_read_region",
+                       (DL_FUNC) &R_nc_read_region);
+  R_RegisterCCallable ("RNetCDF", "R_nc_miss_att",
+                       (DL_FUNC) &R_nc_miss_att);
+  R_RegisterCCallable ("RNetCDF", "R_nc_pack_att",
+                       (DL_FUNC) &R_nc_pack_att);
+  R_RegisterCCallable ("RNetCDF", "R_nc_c2r_init",
+                       (DL_FUNC) &R_nc_api_c2r_init);
+  R_RegisterCCallable ("RNetCDF", "R_nc_c2r",
+                       (DL_FUNC) &R_nc_api_c2r);
+  R_RegisterCCallable ("RNetCDF", "R_nc_r2c",
+                       (DL_FUNC) &R_nc_api_r2c);
+}
+
+
+/* Find each named function with R_GetCCallable, as other packages do,
+   raising an error if any is not registered.
+   Returns the version of the interface, found by calling R_nc_api_version.
+ */
+SEXP
+R_nc_api_check (SEXP names)
+{
+  R_xlen_t ii;
+  int (*version) (void);
+  for (ii=0; ii<xlength (names); ii++) {
+    R_GetCCallable ("RNetCDF", CHAR (STRING_ELT (names, ii)));
+  }
+  version = (int (*) (void)) R_GetCCallable ("RNetCDF", "R_nc_api_version");
+  return ScalarInteger (version ());
+}
@@ -0,0 +1,460 @@
+/*=============================================================================*\
+ *
+ *  Name:       arrow.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Export variable slabs through the Arrow C Data Interface
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "convert.h"
+#include "RNetCDF.h"
+
+
+/* Structures of the Arrow C Data Interface, as defined in
+   https://arrow.apache.org/docs/format/CDataInterface.html
+   The guard allows the definitions to be shared with other headers.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif  /* ARROW_C_DATA_INTERFACE */
+
+
+/* Buffers owned by an exported array, freed when the consumer releases it */
+#define RNC_ARROW_NBUF 3
+typedef struct {
+  void *buffers[RNC_ARROW_NBUF];
+  const void *bufp[RNC_ARROW_NBUF];
+} R_nc_arrow_data;
+
+
+static void
+R_nc_arrow_schema_release (struct ArrowSchema *schema)
+{
+  free ((void *) schema->name);
+  schema->release = NULL;
+}
+
+
+static void
+R_nc_arrow_array_release (struct ArrowArray *array)
+{
+  R_nc_arrow_data *data;
+  int ii;
+  data = array->private_data;
+  if (data) {
+    for (ii=0; ii<RNC_ARROW_NBUF; ii++) {
+      free (data->buffers[ii]);
+    }
+    free (data);
+  }
+  array->release = NULL;
+}
+
+
+/* Finalizers of the external pointers release the structures,
+   unless their contents have been moved to a consumer,
+   which sets the release callback to NULL.
+ */
+static void
+R_nc_arrow_schema_finalizer (SEXP ptr)
+{
+  struct ArrowSchema *schema;
+  schema = R_ExternalPtrAddr (ptr);
+  if (schema) {
+    if (schema->release) {
+      schema->release (schema);
+    }
+    free (schema);
+    R_ClearExternalPtr (ptr);
+  }
+}
+
+
+static void
+R_nc_arrow_array_finalizer (SEXP ptr)
+{
+  struct ArrowArray *array;
+  array = R_ExternalPtrAddr (ptr);
+  if (array) {
+    if (array->release) {
+      array->release (array);
+    }
+    free (array);
+    R_ClearExternalPtr (ptr);
+  }
+}
+
+
+/* Allocate a buffer owned by an exported array.
+   Memory is zeroed, so that unused bits of bitmaps are defined.
+ */
+static void *
+R_nc_arrow_buffer (struct ArrowArray *array, int ibuf, size_t size)
+{
+  R_nc_arrow_data *data;
+  data = array->private_data;
+  data->buffers[ibuf] = calloc (size > 0 ? size : 1, 1);
+  if (!data->buffers[ibuf]) {
+    R_nc_error ("Not enough memory for Arrow buffer");
+  }
+  data->bufp[ibuf] = data->buffers[ibuf];
+  return data->buffers[ibuf];
+}
+
+
+/* Set the validity bitmap of numeric values in an exported array,
+   treating fill values and values outside the valid range as null,
+   in the same way as missing values are found by R_NC_C2R_NUM.
+   Returns the number of null values.
+ */
+#define R_NC_ARROW_VALID(FUN, ITYPE, MINVAL, MAXVAL) \
+static int64_t \
+FUN (const void *buf, size_t cnt, uint8_t *valid, \
+     const void *fill, const void *min, const void *max) \
+{ \
+  size_t ii; \
+  int64_t nnull=0; \
+  ITYPE fillval=0, minval, maxval; \
+  const ITYPE *in; \
+  in = (const ITYPE *) buf; \
+  if (fill) { \
+    fillval = *((const ITYPE *) fill); \
+  } \
+  minval = min ? *((const ITYPE *) min) : MINVAL; \
+  maxval = max ? *((const ITYPE *) max) : MAXVAL; \
+  for (ii=0; ii<cnt; ii++) { \
+    if ((fill && in[ii] == fillval) || (in[ii] < minval) || \
+        (maxval < in[ii])) { \
+      nnull++; \
+    } else { \
+      valid[ii/8] |= (uint8_t) (1 << (ii%8)); \
+    } \
+  } \
+  return nnull; \
+}
+
+R_NC_ARROW_VALID(R_nc_arrow_valid_schar, signed char, SCHAR_MIN, SCHAR_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_uchar, unsigned char, 0, UCHAR_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_short, short, SHRT_MIN, SHRT_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_ushort, unsigned short, 0, USHRT_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_int, int, INT_MIN, INT_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_uint, unsigned int, 0, UINT_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_float, float, -FLT_MAX, FLT_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_dbl, double, -DBL_MAX, DBL_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_ll, long long, LLONG_MIN, LLONG_MAX);
+R_NC_ARROW_VALID(R_nc_arrow_valid_ull, unsigned long long, 0, ULLONG_MAX);
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_get_arrow()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_get_arrow (SEXP nc, SEXP var, SEXP start, SEXP count, SEXP namode)
+{
+  int ncid, varid, ndims, ii, span;
+  size_t *cstart=NULL, *ccount=NULL, cnt, xsize, strsize, nbytes, pos, len,
+         irow;
+  nc_type xtype;
+  char varname[NC_MAX_NAME+1], *chars, **strings;
+  const char *format;
+  void *buf, *fillp=NULL, *minp=NULL, *maxp=NULL;
+  uint8_t *valid;
+  int32_t *offsets;
+  int64_t nnull=0;
+  struct ArrowSchema *schema;
+  struct ArrowArray *array;
+  R_nc_handle *handle;
+  SEXP result, sptr, aptr;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+  R_nc_check (R_nc_var_id (var, ncid, &varid));
+  R_nc_check (nc_inq_var (ncid, varid, varname, &xtype, &ndims, NULL, NULL));
+
+  if (ndims > 0) {
+    cstart = R_nc_dim_r2c_size (start, ndims, 0);
+    ccount = R_nc_dim_r2c_size (count, ndims, 0);
+    for (ii=0; ii<ndims; ii++) {
+      cstart[ii] -= 1;
+    }
+  }
+
+  /*-- Map the external type to an Arrow format -------------------------------*/
+  switch (xtype) {
+  case NC_BYTE:
+    format = "c";
+    break;
+  case NC_UBYTE:
+    format = "C";
+    break;
+  case NC_SHORT:
+    format = "s";
+    break;
+  case NC_USHORT:
+    format = "S";
+    break;
+  case NC_INT:
+    format = "i";
+    break;
+  case NC_UINT:
+    format = "I";
+    break;
+  case NC_INT64:
+    format = "l";
+    break;
+  case NC_UINT64:
+    format = "L";
+    break;
+  case NC_FLOAT:
+    format = "f";
+    break;
+  case NC_DOUBLE:
+    format = "g";
+    break;
+  case NC_CHAR:
+  case NC_STRING:
+    format = "u";
+    break;
+  default:
+    RERROR ("Type of variable is not supported for Arrow export");
+  }
+
+  /* Characters of NC_CHAR variables are strings along the fastest dimension */
+  strsize = 1;
+  if (xtype == NC_CHAR && ndims > 0) {
+    strsize = ccount[ndims-1];
+    cnt = R_nc_length (ndims-1, ccount);
+  } else {
+    cnt = R_nc_length (ndims, ccount);
+  }
+  if (cnt > INT64_MAX) {
+    RERROR ("Too many elements for Arrow array");
+  }
+
+  /*-- Allocate structures released by the consumer or by finalizers ----------*/
+  result = R_nc_protect (allocVector (VECSXP, 2));
+
+  schema = calloc (1, sizeof (struct ArrowSchema));
+  if (!schema) {
+    RERROR ("Not enough memory for Arrow schema");
+  }
+  sptr = R_MakeExternalPtr (schema, R_NilValue, R_NilValue);
+  SET_VECTOR_ELT (result, 0, sptr);
+  R_RegisterCFinalizerEx (sptr, &R_nc_arrow_schema_finalizer, TRUE);
+  schema->format = format;
+  schema->name = malloc (strlen (varname) + 1);
+  if (schema->name) {
+    strcpy ((char *) schema->name, varname);
+  }
+  schema->flags = ARROW_FLAG_NULLABLE;
+  schema->release = &R_nc_arrow_schema_release;
+
+  array = calloc (1, sizeof (struct ArrowArray));
+  if (!array) {
+    RERROR ("Not enough memory for Arrow array");
+  }
+  aptr = R_MakeExternalPtr (array, R_NilValue, R_NilValue);
+  SET_VECTOR_ELT (result, 1, aptr);
+  R_RegisterCFinalizerEx (aptr, &R_nc_arrow_array_finalizer, TRUE);
+  array->private_data = calloc (1, sizeof (R_nc_arrow_data));
+  if (!array->private_data) {
+    RERROR ("Not enough memory for Arrow array");
+  }
+  array->release = &R_nc_arrow_array_release;
+  array->length = cnt;
+  array->buffers = ((R_nc_arrow_data *) array->private_data)->bufp;
+  array->n_buffers = (xtype == NC_CHAR || xtype == NC_STRING) ? 3 : 2;
+
+  /*-- Enter data mode (if necessary) -----------------------------------------*/
+  R_nc_check (R_nc_enddef (ncid));
+
+  /*-- Read data into the buffers of the array --------------------------------*/
+  valid = R_nc_arrow_buffer (array, 0, (cnt + 7) / 8);
+  R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+  span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
+
+  if (xtype == NC_CHAR) {
+    /* Trailing null characters are removed from fixed-length strings,
+       which are packed consecutively into the data buffer */
+    chars = R_nc_arrow_buffer (array, 2, cnt * strsize);
+    offsets = R_nc_arrow_buffer (array, 1, (cnt + 1) * sizeof (int32_t));
+    if (cnt * strsize > INT32_MAX) {
+      RERROR ("Too many characters for Arrow string array");
+    }
+    if (cnt * strsize > 0) {
+      R_nc_check (nc_get_vara_text (ncid, varid, cstart, ccount, chars));
+    }
+    pos = 0;
+    for (irow=0; irow<cnt; irow++) {
+      offsets[irow] = pos;
+      len = strsize;
+      while (len > 0 && chars[irow*strsize + len - 1] == '\0') {
+        len--;
+      }
+      memmove (chars + pos, chars + irow*strsize, len);
+      pos += len;
+      valid[irow/8] |= (uint8_t) (1 << (irow%8));
+    }
+    offsets[cnt] = pos;
+
+  } else if (xtype == NC_STRING) {
+    /* Variable-length strings are copied into the data buffer,
+       and missing strings are null */
+    strings = R_nc_alloc (cnt, sizeof (char *));
+    offsets = R_nc_arrow_buffer (array, 1, (cnt + 1) * sizeof (int32_t));
+    if (cnt > 0) {
+      R_nc_check (nc_get_vara_string (ncid, varid, cstart, ccount, strings));
+    }
+    nbytes = 0;
+    for (irow=0; irow<cnt; irow++) {
+      if (strings[irow]) {
+        nbytes += strlen (strings[irow]);
+      }
+    }
+    if (nbytes > INT32_MAX) {
+      nc_free_string (cnt, strings);
+      RERROR ("Too many characters for Arrow string array");
+    }
+    chars = R_nc_arrow_buffer (array, 2, nbytes);
+    nbytes = 0;
+    for (irow=0; irow<cnt; irow++) {
+      offsets[irow] = nbytes;
+      if (strings[irow]) {
+        len = strlen (strings[irow]);
+        memcpy (chars + nbytes, strings[irow], len);
+        nbytes += len;
+        valid[irow/8] |= (uint8_t) (1 << (irow%8));
+      } else {
+        nnull++;
+      }
+    }
+    offsets[cnt] = nbytes;
+    if (cnt > 0) {
+      nc_free_string (cnt, strings);
+    }
+
+  } else {
+    /* Numeric values keep their external type */
+    buf = R_nc_arrow_buffer (array, 1, cnt * xsize);
+    if (cnt > 0) {
+      R_nc_check (nc_get_vara (ncid, varid, cstart, ccount, buf));
+    }
+    R_nc_trace_end (span);
+    span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
+    R_nc_miss_att (ncid, varid, asInteger (namode), &fillp, &minp, &maxp);
+    R_nc_trace_end (span);
+    span = R_nc_trace_begin ("R_nc_arrow_valid", RNC_TRACE_CONVERT);
+    switch (xtype) {
+    case NC_BYTE:
+      nnull = R_nc_arrow_valid_schar (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_UBYTE:
+      nnull = R_nc_arrow_valid_uchar (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_SHORT:
+      nnull = R_nc_arrow_valid_short (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_USHORT:
+      nnull = R_nc_arrow_valid_ushort (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_INT:
+      nnull = R_nc_arrow_valid_int (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_UINT:
+      nnull = R_nc_arrow_valid_uint (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_INT64:
+      nnull = R_nc_arrow_valid_ll (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_UINT64:
+      nnull = R_nc_arrow_valid_ull (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_FLOAT:
+      nnull = R_nc_arrow_valid_float (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    case NC_DOUBLE:
+      nnull = R_nc_arrow_valid_dbl (buf, cnt, valid, fillp, minp, maxp);
+      break;
+    }
+  }
+  R_nc_trace_end (span);
+  array->null_count = nnull;
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    handle->stats.get_calls++;
+    handle->stats.get_bytes += (double) cnt * strsize * xsize;
+  }
+
+  RRETURN (result);
+}
@@ -86,6 +86,8 @@ R_nc_copy_att (SEXP nc_in, SEXP var_in, SEXP att, SEXP nc_out, SEXP var_out)
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid_in = asInteger (nc_in);
   ncid_out = asInteger (nc_out);
+  R_nc_stats_meta (nc_in);
+  R_nc_stats_meta (nc_out);
 
   if (R_nc_strcmp(var_in, "NC_GLOBAL")) {
     varid_in = NC_GLOBAL;
@@ -124,6 +126,7 @@ R_nc_delete_att (SEXP nc, SEXP var, SEXP att)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   if (R_nc_strcmp(var, "NC_GLOBAL")) {
     varid = NC_GLOBAL;
@@ -160,6 +163,7 @@ R_nc_get_att (SEXP nc, SEXP var, SEXP att, SEXP rawchar, SEXP fitnum)
 
   /*-- Convert arguments ------------------------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   if (R_nc_strcmp(var, "NC_GLOBAL")) {
     varid = NC_GLOBAL;
@@ -205,6 +209,7 @@ R_nc_inq_att (SEXP nc, SEXP var, SEXP att)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   if (R_nc_strcmp(var, "NC_GLOBAL")) {
     varid = NC_GLOBAL;
@@ -249,6 +254,7 @@ R_nc_put_att (SEXP nc, SEXP var, SEXP att, SEXP type, SEXP data)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   if (R_nc_strcmp(var, "NC_GLOBAL")) {
     varid = NC_GLOBAL;
@@ -290,6 +296,7 @@ R_nc_rename_att (SEXP nc, SEXP var, SEXP att, SEXP newname)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   if (R_nc_strcmp(var, "NC_GLOBAL")) {
     varid = NC_GLOBAL;
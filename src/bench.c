@@ -0,0 +1,147 @@
+/*=============================================================================*\
+ *
+ *  Name:       bench.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Timing of RNetCDF type conversions for benchmarks
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <string.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "convert.h"
+#include "RNetCDF.h"
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_bench_convert()
+\*-----------------------------------------------------------------------------*/
+
+/* Time the conversions used by var.put.nc (R to C) and var.get.nc (C to R)
+   for a whole variable, without the cost of netcdf library I/O.
+   Conversion from C to R may modify or free the C buffer,
+   so the buffer is read from the dataset before each repetition.
+   Result is a list of two vectors, containing elapsed times (seconds)
+   of each repetition for R to C and C to R conversions.
+ */
+SEXP
+R_nc_bench_convert (SEXP nc, SEXP var, SEXP data, SEXP rawchar,
+                    SEXP fitnum, SEXP namode, SEXP pack, SEXP reps)
+{
+  int ncid, varid, ndims, ii, israw, isfit, inamode, ispack, nrep, irep;
+  int *dimids;
+  size_t *cstart=NULL, *ccount=NULL;
+  nc_type xtype;
+  double scale, add, *scalep=NULL, *addp=NULL, time0, *timer2c, *timec2r;
+  void *fillp=NULL, *minp=NULL, *maxp=NULL, *buf;
+  R_nc_mark mark;
+  R_nc_buf io;
+  SEXP result, tr2c, tc2r;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  R_nc_check (R_nc_var_id (var, ncid, &varid));
+
+  israw = (asLogical (rawchar) == TRUE);
+  isfit = (asLogical (fitnum) == TRUE);
+  inamode = asInteger (namode);
+  ispack = (asLogical (pack) == TRUE);
+  nrep = asInteger (reps);
+  if (nrep == NA_INTEGER || nrep < 1) {
+    RERROR ("Number of repetitions must be positive");
+  }
+
+  /*-- Find the shape of the whole variable -----------------------------------*/
+  R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
+  if (ndims > 0) {
+    dimids = (int *) R_alloc (ndims, sizeof (int));
+    cstart = (size_t *) R_alloc (ndims, sizeof (size_t));
+    ccount = (size_t *) R_alloc (ndims, sizeof (size_t));
+    R_nc_check (nc_inq_vardimid (ncid, varid, dimids));
+    for (ii=0; ii<ndims; ii++) {
+      cstart[ii] = 0;
+      R_nc_check (nc_inq_dimlen (ncid, dimids[ii], &(ccount[ii])));
+    }
+  }
+
+  /*-- Get fill and packing attributes (if any) -------------------------------*/
+  R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
+  if (ispack) {
+    scalep = &scale;
+    addp = &add;
+    R_nc_pack_att (ncid, varid, &scalep, &addp);
+  }
+
+  R_nc_check (R_nc_enddef (ncid));
+
+  /* Times are stored in C arrays, so that memory and R objects created by
+     each repetition can be released before the next */
+  timer2c = (double *) R_alloc (nrep, sizeof (double));
+  timec2r = (double *) R_alloc (nrep, sizeof (double));
+
+  /*-- Time conversions from R to C -------------------------------------------*/
+  for (irep=0; irep<nrep; irep++) {
+    mark = R_nc_mark_get ();
+    time0 = R_nc_timer ();
+    R_nc_r2c (data, ncid, xtype, ndims, ccount, fillp, scalep, addp);
+    timer2c[irep] = R_nc_timer () - time0;
+    R_nc_release (mark);
+  }
+
+  /*-- Time conversions from C to R -------------------------------------------*/
+  for (irep=0; irep<nrep; irep++) {
+    mark = R_nc_mark_get ();
+    buf = R_nc_c2r_init (&io, NULL, ncid, xtype, ndims, ccount,
+                         israw, isfit, fillp, minp, maxp, scalep, addp);
+    if (R_nc_length (ndims, ccount) > 0) {
+      R_nc_check (nc_get_vara (ncid, varid, cstart, ccount, buf));
+    }
+    time0 = R_nc_timer ();
+    R_nc_c2r (&io);
+    timec2r[irep] = R_nc_timer () - time0;
+    R_nc_release (mark);
+  }
+
+  /*-- Returning the list -----------------------------------------------------*/
+  tr2c = R_nc_protect (allocVector (REALSXP, nrep));
+  tc2r = R_nc_protect (allocVector (REALSXP, nrep));
+  memcpy (REAL (tr2c), timer2c, nrep * sizeof (double));
+  memcpy (REAL (tc2r), timec2r, nrep * sizeof (double));
+
+  result = R_nc_protect (allocVector (VECSXP, 2));
+  SET_VECTOR_ELT (result, 0, tr2c);
+  SET_VECTOR_ELT (result, 1, tc2r);
+
+  RRETURN(result);
+}
+
@@ -0,0 +1,467 @@
+/*=============================================================================*\
+ *
+ *  Name:       cache.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Persistent cache of variables read by var.get.nc
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#ifdef __WIN32__
+# include <process.h>
+#else
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+#endif
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "RNetCDF.h"
+
+
+/* Settings and counters of the result cache.
+   Results are stored in files of directory dir, up to size bytes in total,
+   and the least recently used files are deleted when the limit is exceeded.
+   The cache is disabled if size is zero.
+ */
+static struct {
+  double size;
+  char *dir;
+  double hits, misses, bytes;
+} R_nc_cache = {0, NULL, 0, 0, 0};
+
+
+/* Each file contains a header, the key, the dimensions (as doubles)
+   and the elements of the result. Numeric elements are stored in native
+   byte order, and each string is stored as its length (-1 for NA)
+   followed by its bytes without a terminating null.
+ */
+static const char RNC_CACHE_MAGIC[8]="RNCRES1";
+
+typedef struct {
+  char magic[8];
+  int32_t keylen, type, integer64, ndim;
+  double length;
+} R_nc_cache_head;
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Cache keys and files
+\*-----------------------------------------------------------------------------*/
+
+char *
+R_nc_cache_key (int ncid, int varid, int ndims, const size_t *start,
+                const size_t *count, int rawchar, int fitnum, int namode,
+                int unpack)
+{
+  struct stat info;
+  size_t len, pos;
+  char *path, *group, *key;
+  long nsec;
+  int ii;
+
+  if (R_nc_cache.size <= 0 || !R_nc_cache.dir) {
+    return NULL;
+  }
+
+  /* Only local files are identified by their size and modification time,
+     which has nanosecond resolution where the platform supports it */
+  if (nc_inq_path (ncid, &len, NULL) != NC_NOERR) {
+    return NULL;
+  }
+  path = R_nc_alloc (len + 1, 1);
+  if (nc_inq_path (ncid, NULL, path) != NC_NOERR ||
+      stat (path, &info) != 0 || !S_ISREG (info.st_mode)) {
+    return NULL;
+  }
+  if (nc_inq_grpname_full (ncid, &len, NULL) != NC_NOERR) {
+    return NULL;
+  }
+  group = R_nc_alloc (len + 1, 1);
+  if (nc_inq_grpname_full (ncid, NULL, group) != NC_NOERR) {
+    return NULL;
+  }
+
+#if defined HAVE_STRUCT_STAT_ST_MTIM
+  nsec = info.st_mtim.tv_nsec;
+#elif defined __APPLE__
+  nsec = info.st_mtimespec.tv_nsec;
+#else
+  nsec = 0;
+#endif
+
+  len = strlen (path) + strlen (group) + 144 + 44 * ndims;
+  key = R_nc_alloc (len, 1);
+  pos = snprintf (key, len, "%s|%.0f.%09ld|%.0f|%s|%i|%i,%i,%i,%i|", path,
+                  (double) info.st_mtime, nsec, (double) info.st_size, group,
+                  varid, rawchar, fitnum, namode, unpack);
+  for (ii=0; ii<ndims && pos<len; ii++) {
+    pos += snprintf (key + pos, len - pos, "%lu:%lu,",
+                     (unsigned long) start[ii], (unsigned long) count[ii]);
+  }
+  return key;
+}
+
+
+/* Name of the file of a result in the cache directory, using a hash of key.
+   Result is allocated by R_nc_alloc.
+ */
+static char *
+R_nc_cache_path (const char *key, const char *suffix)
+{
+  size_t len;
+  char *path;
+  len = strlen (R_nc_cache.dir) + 64;
+  path = R_nc_alloc (len, 1);
+  snprintf (path, len, "%s/%016llx%s", R_nc_cache.dir,
+            R_nc_hash (0, key, strlen (key)), suffix);
+  return path;
+}
+
+
+/* Size of each element of a result type, or 0 if the type is not cached */
+static size_t
+R_nc_cache_eltsize (int type)
+{
+  switch (type) {
+  case LGLSXP:
+  case INTSXP:
+    return sizeof (int);
+  case REALSXP:
+    return sizeof (double);
+  case RAWSXP:
+    return 1;
+  case STRSXP:
+    return sizeof (int32_t);
+  default:
+    return 0;
+  }
+}
+
+
+/* Pointer to the elements of an atomic vector that is not a string */
+static void *
+R_nc_cache_dataptr (SEXP x)
+{
+  switch (TYPEOF (x)) {
+  case LGLSXP:
+    return LOGICAL (x);
+  case INTSXP:
+    return INTEGER (x);
+  case REALSXP:
+    return REAL (x);
+  default:
+    return RAW (x);
+  }
+}
+
+
+/* Convert the contents of a file to an R object.
+   Returns R_NilValue if the file is invalid or was stored with another key.
+ */
+static SEXP
+R_nc_cache_decode (const char *key, const unsigned char *data, size_t size)
+{
+  R_nc_cache_head head;
+  const unsigned char *pos, *end;
+  size_t keylen, ii, length, eltsize;
+  int32_t strlen32;
+  double *dims;
+  SEXP result, rdim;
+
+  end = data + size;
+  if (size < sizeof (head)) {
+    return R_NilValue;
+  }
+  memcpy (&head, data, sizeof (head));
+  pos = data + sizeof (head);
+  keylen = strlen (key);
+  if (memcmp (head.magic, RNC_CACHE_MAGIC, sizeof (head.magic)) != 0 ||
+      head.keylen != (int32_t) keylen || head.ndim < 0 ||
+      (size_t) head.ndim > (size_t) (end - pos) / sizeof (double) ||
+      (size_t) (end - pos) < keylen + head.ndim * sizeof (double) ||
+      memcmp (pos, key, keylen) != 0) {
+    return R_NilValue;
+  }
+  pos += keylen;
+  dims = (double *) R_nc_alloc (head.ndim, sizeof (double));
+  memcpy (dims, pos, head.ndim * sizeof (double));
+  pos += head.ndim * sizeof (double);
+
+  /* Check type and length against the size of the file before allocation;
+     each string occupies at least the bytes of its length */
+  eltsize = R_nc_cache_eltsize (head.type);
+  if (eltsize == 0 || !(head.length >= 0) ||
+      head.length != floor (head.length) ||
+      head.length > (double) ((size_t) (end - pos) / eltsize)) {
+    return R_NilValue;
+  }
+  length = head.length;
+  if (head.type != STRSXP && (size_t) (end - pos) != length * eltsize) {
+    return R_NilValue;
+  }
+  result = R_nc_protect (allocVector (head.type, length));
+  if (head.type == STRSXP) {
+    for (ii=0; ii<length; ii++) {
+      if ((size_t) (end - pos) < sizeof (strlen32)) {
+        return R_NilValue;
+      }
+      memcpy (&strlen32, pos, sizeof (strlen32));
+      pos += sizeof (strlen32);
+      if (strlen32 < 0) {
+        SET_STRING_ELT (result, ii, NA_STRING);
+      } else if ((size_t) (end - pos) < (size_t) strlen32) {
+        return R_NilValue;
+      } else {
+        SET_STRING_ELT (result, ii,
+          mkCharLenCE ((const char *) pos, strlen32, CE_NATIVE));
+        pos += strlen32;
+      }
+    }
+  } else {
+    if (length > 0) {
+      memcpy (R_nc_cache_dataptr (result), pos, length * eltsize);
+    }
+  }
+
+  if (head.ndim > 0) {
+    rdim = R_nc_protect (allocVector (REALSXP, head.ndim));
+    memcpy (REAL (rdim), dims, head.ndim * sizeof (double));
+    setAttrib (result, R_DimSymbol, rdim);
+  }
+  if (head.integer64) {
+    classgets (result, mkString ("integer64"));
+  }
+  return result;
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Reading and writing results
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_cache_get (const char *key)
+{
+  char *path;
+  unsigned char *data;
+  size_t size;
+  SEXP result=R_NilValue;
+#ifdef __WIN32__
+  FILE *file;
+  struct stat info;
+#else
+  int fd;
+  struct stat info;
+#endif
+
+  path = R_nc_cache_path (key, ".res");
+
+#ifdef __WIN32__
+  file = fopen (path, "rb");
+  if (!file) {
+    R_nc_cache.misses++;
+    return R_NilValue;
+  }
+  if (stat (path, &info) == 0) {
+    size = info.st_size;
+    data = R_nc_alloc (size, 1);
+    if (fread (data, 1, size, file) == size) {
+      result = R_nc_cache_decode (key, data, size);
+    }
+  }
+  fclose (file);
+#else
+  /* The file is mapped into memory, so that it is copied only once */
+  fd = open (path, O_RDONLY);
+  if (fd < 0) {
+    R_nc_cache.misses++;
+    return R_NilValue;
+  }
+  if (fstat (fd, &info) == 0 && info.st_size > 0) {
+    size = info.st_size;
+    data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      result = R_nc_cache_decode (key, data, size);
+      munmap (data, size);
+    }
+  }
+  close (fd);
+#endif
+
+  if (result == R_NilValue) {
+    R_nc_cache.misses++;
+  } else {
+    R_nc_cache.hits++;
+    utime (path, NULL);
+  }
+  return result;
+}
+
+
+void
+R_nc_cache_put (const char *key, SEXP result)
+{
+  R_nc_cache_head head;
+  char *path, *tmppath;
+  size_t len, ii, eltsize;
+  int32_t strlen32;
+  double *dims=NULL;
+  SEXP attr, rdim, elt;
+  FILE *file;
+  int ok;
+
+  /* Results are cached if they are atomic vectors or arrays,
+     with no other attributes than dimensions or class integer64 */
+  memset (&head, 0, sizeof (head));
+  head.type = TYPEOF (result);
+  eltsize = R_nc_cache_eltsize (head.type);
+  if (eltsize == 0) {
+    return;
+  }
+  for (attr=ATTRIB (result); attr != R_NilValue; attr=CDR (attr)) {
+    if (TAG (attr) == R_ClassSymbol && R_nc_inherits (result, "integer64")) {
+      head.integer64 = 1;
+    } else if (TAG (attr) != R_DimSymbol) {
+      return;
+    }
+  }
+  memcpy (head.magic, RNC_CACHE_MAGIC, sizeof (head.magic));
+  len = strlen (key);
+  head.keylen = len;
+  head.length = xlength (result);
+  rdim = getAttrib (result, R_DimSymbol);
+  head.ndim = length (rdim);
+  if (head.ndim > 0) {
+    dims = (double *) R_nc_alloc (head.ndim, sizeof (double));
+    for (ii=0; ii<(size_t) head.ndim; ii++) {
+      dims[ii] = (TYPEOF (rdim) == REALSXP) ? REAL (rdim)[ii]
+                                            : INTEGER (rdim)[ii];
+    }
+  }
+
+  /* Write to a temporary file, which is renamed when complete,
+     so that readers never see a partial result */
+  path = R_nc_cache_path (key, ".res");
+  len = strlen (path) + 32;
+  tmppath = R_nc_alloc (len, 1);
+  snprintf (tmppath, len, "%s.%i.tmp", path, (int) getpid ());
+  file = fopen (tmppath, "wb");
+  if (!file) {
+    return;
+  }
+  ok = (fwrite (&head, sizeof (head), 1, file) == 1 &&
+        fwrite (key, 1, head.keylen, file) == (size_t) head.keylen &&
+        (head.ndim == 0 ||
+         fwrite (dims, sizeof (double), head.ndim, file) ==
+           (size_t) head.ndim));
+  if (head.type == STRSXP) {
+    for (ii=0; ok && ii<(size_t) head.length; ii++) {
+      elt = STRING_ELT (result, ii);
+      if (elt == NA_STRING) {
+        strlen32 = -1;
+        ok = (fwrite (&strlen32, sizeof (strlen32), 1, file) == 1);
+      } else {
+        strlen32 = LENGTH (elt);
+        ok = (fwrite (&strlen32, sizeof (strlen32), 1, file) == 1 &&
+              fwrite (CHAR (elt), 1, strlen32, file) == (size_t) strlen32);
+      }
+    }
+  } else if (ok && head.length > 0) {
+    ok = (fwrite (R_nc_cache_dataptr (result), eltsize, head.length,
+                  file) == (size_t) head.length);
+  }
+  ok = (fclose (file) == 0) && ok;
+
+  remove (path);
+  if (!ok || rename (tmppath, path) != 0) {
+    remove (tmppath);
+    return;
+  }
+  R_nc_cache.bytes += head.length * eltsize;
+  R_nc_dir_trim (R_nc_cache.dir, ".res", R_nc_cache.size);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_result_cache()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_result_cache (SEXP size, SEXP dir, SEXP reset)
+{
+  double dval;
+  SEXP result;
+
+  /*-- Change settings that are not NA ----------------------------------------*/
+  dval = asReal (size);
+  if (!ISNA (dval)) {
+    R_nc_cache.size = (dval > 0) ? dval * 1048576 : 0;
+  }
+  if (isString (dir) && STRING_ELT (dir, 0) != NA_STRING) {
+    free (R_nc_cache.dir);
+    R_nc_cache.dir = strdup (R_ExpandFileName (R_nc_strarg (dir)));
+  }
+  if (R_nc_cache.size > 0 && !R_nc_cache.dir) {
+    RERROR ("Directory of result cache must be specified");
+  }
+  if (R_nc_cache.size > 0) {
+    R_nc_dir_trim (R_nc_cache.dir, ".res", R_nc_cache.size);
+  }
+
+  /*-- Returning the list -----------------------------------------------------*/
+  result = R_nc_protect (allocVector (VECSXP, 5));
+  SET_VECTOR_ELT (result, 0, ScalarReal (R_nc_cache.size / 1048576));
+  SET_VECTOR_ELT (result, 1, R_nc_cache.dir ? mkString (R_nc_cache.dir)
+                                            : ScalarString (NA_STRING));
+  SET_VECTOR_ELT (result, 2, ScalarReal (R_nc_cache.hits));
+  SET_VECTOR_ELT (result, 3, ScalarReal (R_nc_cache.misses));
+  SET_VECTOR_ELT (result, 4, ScalarReal (R_nc_cache.bytes));
+
+  /*-- Reset the counters (if requested) --------------------------------------*/
+  if (asLogical (reset) == TRUE) {
+    R_nc_cache.hits = 0;
+    R_nc_cache.misses = 0;
+    R_nc_cache.bytes = 0;
+  }
+
+  RRETURN(result);
+}
@@ -0,0 +1,264 @@
+/*=============================================================================*\
+ *
+ *  Name:       chunk.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Choice of chunk shapes for NetCDF variables
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <math.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "RNetCDF.h"
+
+
+/* Assumed length of an unlimited dimension in a variable without
+   fixed dimensions */
+#define RNC_CHUNK_NREC 1024
+
+/* Labels of access patterns, in the order of R_nc_chunk_pattern */
+static const char *R_nc_chunk_accesses[] = {"balanced", "timeseries", "map"};
+
+
+/* Distribute a budget of elements among the dimensions of a chunk.
+   Dimensions with weight 0 have chunk length 1,
+   dimensions with infinite weight are given as much of the budget
+   as their capacity allows, and the remaining budget is divided among
+   other dimensions in proportion to their weights,
+   so that the numbers of chunks along those dimensions are similar.
+   Chunk lengths are limited by the capacity of each dimension.
+ */
+static void
+R_nc_chunk_fill (int ndims, const double *cap, const double *weight,
+                 double budget, double *chunk)
+{
+  int idim, nfree, fixed;
+  double wprod, factor;
+  int *isfree;
+
+  isfree = (int *) R_nc_alloc (ndims, sizeof (int));
+
+  /*-- Fix chunks of unweighted and fully weighted dimensions ----------------*/
+  for (idim=0; idim<ndims; idim++) {
+    isfree[idim] = 0;
+    if (weight[idim] <= 0) {
+      chunk[idim] = 1;
+    } else if (!R_FINITE (weight[idim])) {
+      chunk[idim] = fmax (1, fmin (cap[idim], budget));
+      budget /= chunk[idim];
+    } else {
+      isfree[idim] = 1;
+    }
+  }
+
+  /*-- Share the remaining budget in proportion to the weights ---------------*/
+  do {
+    fixed = 0;
+    nfree = 0;
+    wprod = 1;
+    for (idim=0; idim<ndims; idim++) {
+      if (isfree[idim]) {
+        nfree++;
+        wprod *= weight[idim];
+      }
+    }
+    if (nfree == 0) {
+      break;
+    }
+    factor = pow (fmax (budget, 1) / wprod, 1.0 / nfree);
+    for (idim=0; idim<ndims; idim++) {
+      if (isfree[idim] && weight[idim] * factor >= cap[idim]) {
+        /* Whole dimension fits in the chunk */
+        chunk[idim] = cap[idim];
+        budget /= cap[idim];
+        isfree[idim] = 0;
+        fixed = 1;
+      }
+    }
+    if (!fixed) {
+      for (idim=0; idim<ndims; idim++) {
+        if (isfree[idim]) {
+          chunk[idim] = weight[idim] * factor;
+        }
+      }
+    }
+  } while (fixed);
+
+  /*-- Round to whole elements ------------------------------------------------*/
+  for (idim=0; idim<ndims; idim++) {
+    chunk[idim] = fmax (1, fmin (floor (chunk[idim]), cap[idim]));
+  }
+}
+
+
+/* Find a chunk shape for a variable with ndims dimensions (C order)
+   of lengths len and elements of xsize bytes, so that chunks contain about
+   target bytes and suit the given access pattern. Unlimited dimensions
+   are flagged by unlim, and they are treated as the record dimensions
+   for timeseries and map access (or dimension 0 if no dimension is unlimited).
+   Chunk lengths are stored in chunk (C order).
+ */
+static void
+R_nc_chunk_shape (int ndims, const size_t *len, const int *unlim,
+                  size_t xsize, size_t target, int access, size_t *chunk)
+{
+  int idim, isrec, hasunlim=0, nfixed=0;
+  double *cap, *weight, *dchunk, budget, gmean=1;
+
+  if (ndims <= 0) {
+    return;
+  }
+
+  cap = (double *) R_nc_alloc (ndims, sizeof (double));
+  weight = (double *) R_nc_alloc (ndims, sizeof (double));
+  dchunk = (double *) R_nc_alloc (ndims, sizeof (double));
+
+  /* Unlimited dimensions are assumed to grow to at least the typical
+     (geometric mean) length of the fixed dimensions, or RNC_CHUNK_NREC
+     if there are none. This limits the space allocated for chunks
+     when the first records of a variable are written. */
+  for (idim=0; idim<ndims; idim++) {
+    if (unlim[idim]) {
+      hasunlim = 1;
+    } else if (len[idim] > 0) {
+      gmean *= len[idim];
+      nfixed++;
+    }
+  }
+  if (nfixed > 0) {
+    gmean = pow (gmean, 1.0 / nfixed);
+  } else {
+    gmean = RNC_CHUNK_NREC;
+  }
+
+  for (idim=0; idim<ndims; idim++) {
+    cap[idim] = fmax (len[idim], unlim[idim] ? gmean : 1);
+    weight[idim] = cap[idim];
+    isrec = hasunlim ? unlim[idim] : (idim == 0);
+    if (isrec && access == RNC_CHUNK_TIMESERIES) {
+      weight[idim] = R_PosInf;
+    } else if (isrec && access == RNC_CHUNK_MAP) {
+      weight[idim] = 0;
+    }
+  }
+
+  budget = fmax (1, (double) target / fmax (xsize, 1));
+  R_nc_chunk_fill (ndims, cap, weight, budget, dchunk);
+
+  for (idim=0; idim<ndims; idim++) {
+    chunk[idim] = dchunk[idim];
+  }
+}
+
+
+/* Find a chunk shape for a netcdf variable with elements of type xtype
+   and ndims dimensions (C order), from the current lengths of the dimensions.
+   Chunks contain about target bytes and suit the given access pattern.
+   Chunk lengths are stored in chunk (C order).
+ */
+void
+R_nc_chunk_auto (int ncid, nc_type xtype, int ndims, const int *dimids,
+                 int access, size_t target, size_t *chunk)
+{
+  int ii, *unlim;
+  size_t xsize, *len;
+
+  R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+
+  unlim = (int *) R_nc_alloc (ndims, sizeof (int));
+  len = (size_t *) R_nc_alloc (ndims, sizeof (size_t));
+
+  for (ii=0; ii<ndims; ii++) {
+    R_nc_check (nc_inq_dimlen (ncid, dimids[ii], &(len[ii])));
+    unlim[ii] = R_nc_isunlim (ncid, dimids[ii]);
+  }
+
+  R_nc_chunk_shape (ndims, len, unlim, xsize, target, access, chunk);
+}
+
+
+/* Convert the label of an access pattern to R_nc_chunk_pattern */
+int
+R_nc_chunk_access (SEXP access)
+{
+  int ii;
+  for (ii=RNC_CHUNK_BALANCED; ii<=RNC_CHUNK_MAP; ii++) {
+    if (R_nc_strcmp (access, R_nc_chunk_accesses[ii])) {
+      return ii;
+    }
+  }
+  R_nc_error ("Unknown access pattern");
+  return -1;
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_chunk_advise()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_chunk_advise (SEXP nc, SEXP type, SEXP dims, SEXP access, SEXP target)
+{
+  int ncid, ndims, ii, jj, *dimids, iaccess;
+  nc_type xtype;
+  size_t *chunk;
+  SEXP result;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
+
+  R_nc_check (R_nc_type_id (type, ncid, &xtype, 0));
+  iaccess = R_nc_chunk_access (access);
+
+  ndims = length (dims);
+  dimids = (int *) R_nc_alloc (ndims, sizeof (int));
+  chunk = (size_t *) R_nc_alloc (ndims, sizeof (size_t));
+
+  for (ii=0, jj=ndims-1; ii<ndims; ii++, jj--) {
+    /* Handle dimension names and convert from R to C storage order */
+    R_nc_check (R_nc_dim_id (dims, ncid, &dimids[jj], ii));
+  }
+
+  /*-- Choose the chunk shape -------------------------------------------------*/
+  R_nc_chunk_auto (ncid, xtype, ndims, dimids, iaccess,
+                   R_nc_sizearg (target), chunk);
+
+  /*-- Return chunk sizes in R order ------------------------------------------*/
+  result = R_nc_protect (allocVector (REALSXP, ndims));
+  for (ii=0, jj=ndims-1; ii<ndims; ii++, jj--) {
+    REAL (result)[ii] = chunk[jj];
+  }
+
+  RRETURN(result);
+}
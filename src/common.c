@@ -30,7 +30,18 @@
  *=============================================================================*
  */
 
+#include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifdef __WIN32__
+# include <windows.h>
+#else
+# include <time.h>
+# include <sys/time.h>
+#endif
 
 #include <R.h>
 #include <Rinternals.h>
@@ -47,6 +58,8 @@
 
 static int R_nc_protect_count = 0;
 
+double R_nc_alloc_total = 0, R_nc_alloc_used = 0, R_nc_alloc_peak = 0;
+
 SEXP
 R_nc_protect (SEXP obj)
 {
@@ -63,6 +76,8 @@ R_nc_unprotect (void)
     UNPROTECT (R_nc_protect_count);
     R_nc_protect_count = 0;
   }
+  /* Memory from R_nc_alloc is reclaimed by R when the native routine returns */
+  R_nc_alloc_used = 0;
 }
 
 
@@ -70,6 +85,7 @@ void
 R_nc_error(const char *msg)
 {
   R_nc_unprotect ();
+  R_nc_trace_unwind ();
   error (msg);
 }
 
@@ -84,6 +100,94 @@ R_nc_check(int status)
 }
 
 
+R_nc_handle *
+R_nc_handle_get (SEXP nc)
+{
+  SEXP ptr;
+  ptr = getAttrib (nc, install ("handle_ptr"));
+  if (TYPEOF (ptr) == EXTPTRSXP) {
+    return R_ExternalPtrAddr (ptr);
+  } else {
+    return NULL;
+  }
+}
+
+
+void
+R_nc_stats_meta (SEXP nc)
+{
+  R_nc_handle *handle;
+  handle = R_nc_handle_get (nc);
+  if (handle) {
+    handle->stats.meta_calls++;
+  }
+}
+
+
+double
+R_nc_timer (void)
+{
+#if defined __WIN32__
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&count);
+  return (double) count.QuadPart / (double) freq.QuadPart;
+#elif defined CLOCK_MONOTONIC
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec + 1.0e-9 * now.tv_nsec;
+#else
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return now.tv_sec + 1.0e-6 * now.tv_usec;
+#endif
+}
+
+
+void *
+R_nc_alloc (size_t n, int size)
+{
+  double bytes;
+  bytes = (double) n * size;
+  R_nc_alloc_total += bytes;
+  R_nc_alloc_used += bytes;
+  if (R_nc_alloc_used > R_nc_alloc_peak) {
+    R_nc_alloc_peak = R_nc_alloc_used;
+  }
+  return R_alloc (n, size);
+}
+
+
+R_nc_mark
+R_nc_mark_get (void)
+{
+  R_nc_mark mark;
+  mark.vmax = vmaxget ();
+  mark.used = R_nc_alloc_used;
+  mark.nprotect = R_nc_protect_count;
+  return mark;
+}
+
+
+void
+R_nc_release_protect (R_nc_mark mark)
+{
+  if (R_nc_protect_count > mark.nprotect) {
+    UNPROTECT (R_nc_protect_count - mark.nprotect);
+    R_nc_protect_count = mark.nprotect;
+  }
+}
+
+
+void
+R_nc_release (R_nc_mark mark)
+{
+  R_nc_release_protect (mark);
+  vmaxset (mark.vmax);
+  R_nc_alloc_used = mark.used;
+}
+
+
 int
 R_nc_strcmp (SEXP var, const char *str)
 {
@@ -378,8 +482,10 @@ R_nc_sizearg (SEXP size)
 int
 R_nc_redef (int ncid)
 {
-  int status;
+  int status, span;
+  span = R_nc_trace_begin ("nc_redef", RNC_TRACE_MODE);
   status = nc_redef(ncid);
+  R_nc_trace_end (span);
   if (status == NC_EINDEFINE) {
     status = NC_NOERR;
   }
@@ -390,7 +496,67 @@ R_nc_redef (int ncid)
 int
 R_nc_enddef (int ncid)
 {
+  int span;
+  span = R_nc_trace_begin ("nc_enddef", RNC_TRACE_MODE);
   nc_enddef(ncid);
+  R_nc_trace_end (span);
   return NC_NOERR;
 }
 
+
+unsigned long long
+R_nc_hash (unsigned long long hash, const void *data, size_t size)
+{
+  const unsigned char *ch;
+  size_t ii;
+  if (hash == 0) {
+    hash = 14695981039346656037ULL;
+  }
+  ch = data;
+  for (ii=0; ii<size; ii++) {
+    hash = (hash ^ ch[ii]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+void
+R_nc_dir_trim (const char *dirname, const char *suffix, double limit)
+{
+  DIR *dir;
+  struct dirent *entry;
+  struct stat info;
+  char *path, *oldest;
+  size_t len;
+  double total;
+  time_t tmin;
+
+  len = strlen (dirname) + 256;
+  path = R_nc_alloc (len, 1);
+  oldest = R_nc_alloc (len, 1);
+
+  do {
+    dir = opendir (dirname);
+    if (!dir) {
+      return;
+    }
+    total = 0;
+    tmin = 0;
+    oldest[0] = '\0';
+    while ((entry = readdir (dir))) {
+      if (!strstr (entry->d_name, suffix)) {
+        continue;
+      }
+      snprintf (path, len, "%s/%s", dirname, entry->d_name);
+      if (stat (path, &info) != 0) {
+        continue;
+      }
+      total += info.st_size;
+      if (oldest[0] == '\0' || info.st_mtime < tmin) {
+        tmin = info.st_mtime;
+        strcpy (oldest, path);
+      }
+    }
+    closedir (dir);
+  } while (total > limit && oldest[0] != '\0' && remove (oldest) == 0);
+}
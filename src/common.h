@@ -40,6 +40,23 @@
   #define NC_MAX_ATOMIC_TYPE NC_STRING
 #endif
 
+/* Quantization modes and attributes of netcdf-4.9 or later,
+   also used by RNetCDF if the library does not support quantization */
+#ifndef NC_QUANTIZE_NOQUANTIZE
+  #define NC_QUANTIZE_NOQUANTIZE 0
+  #define NC_QUANTIZE_BITGROOM 1
+  #define NC_QUANTIZE_GRANULARBR 2
+  #define NC_QUANTIZE_BITROUND 3
+#endif
+#ifndef NC_QUANTIZE_BITGROOM_ATT_NAME
+  #define NC_QUANTIZE_BITGROOM_ATT_NAME \
+    "_QuantizeBitGroomNumberOfSignificantDigits"
+  #define NC_QUANTIZE_GRANULARBR_ATT_NAME \
+    "_QuantizeGranularBitRoundNumberOfSignificantDigits"
+  #define NC_QUANTIZE_BITROUND_ATT_NAME \
+    "_QuantizeBitRoundNumberOfSignificantBits"
+#endif
+
 #define RRETURN(object) { R_nc_unprotect (); return (object); }
 
 #define RERROR(msg) { R_nc_error (msg); return NULL; }
@@ -49,6 +66,31 @@
 /* Definition of missing value used by bit64 package */
 #define NA_INTEGER64 LLONG_MIN
 
+/* Counters of activity on a netcdf dataset, accumulated by the handle */
+typedef struct {
+  double get_calls, get_bytes, put_calls, put_bytes;
+  double io_time, convert_time, meta_calls, alloc_bytes, peak_bytes;
+} R_nc_stats;
+
+/* Length of an unlimited dimension when a followed dataset was refreshed */
+typedef struct {
+  int grpid, dimid;
+  size_t length;
+} R_nc_recdim;
+
+/* Data referenced by the external pointer of a netcdf dataset handle */
+typedef struct {
+  int ncid;
+  int zarr; /* 1 if chunks of an NCZarr store may be read directly */
+  int threads; /* threads for reading chunks, or 0 for the OpenMP default */
+  void *image; /* contents of a cached remote dataset, or NULL */
+  int readonly; /* 1 if the dataset was opened without write access */
+  int follow; /* 1 if records appended by another process are followed */
+  int nrecdim; /* number of unlimited dimensions in recdim */
+  R_nc_recdim *recdim; /* unlimited dimensions of a followed dataset */
+  R_nc_stats stats;
+} R_nc_handle;
+
 /* Common error strings */
 static const char RNC_EDATALEN[]="Not enough data", \
   RNC_EDATATYPE[]="Incompatible data for external type", \
@@ -58,7 +100,8 @@ static const char RNC_EDATALEN[]="Not enough data", \
 SEXP
 R_nc_protect (SEXP obj);
 
-/* Unprotect all objects to enable garbage collection by R */
+/* Unprotect all objects to enable garbage collection by R,
+   and reset the count of memory in use (R_nc_alloc_used) */
 void
 R_nc_unprotect (void);
 
@@ -71,6 +114,136 @@ R_nc_error(const char *msg);
 int
 R_nc_check(int status);
 
+/* Find the dataset handle associated with an R object of class NetCDF.
+   Result is NULL if the object has no valid handle.
+ */
+R_nc_handle *
+R_nc_handle_get (SEXP nc);
+
+/* Count a metadata operation on the dataset associated with an R object.
+ */
+void
+R_nc_stats_meta (SEXP nc);
+
+/* Return elapsed time in seconds from an arbitrary origin.
+ */
+double
+R_nc_timer (void);
+
+/* Allocate memory that is freed by R (as R_alloc),
+   counting the number of bytes in R_nc_alloc_total.
+   Bytes that have not been released by R_nc_release are counted in
+   R_nc_alloc_used, and the maximum of R_nc_alloc_used is R_nc_alloc_peak.
+ */
+extern double R_nc_alloc_total, R_nc_alloc_used, R_nc_alloc_peak;
+
+void *
+R_nc_alloc (size_t n, int size);
+
+/* Scoped arena for temporary memory in loops.
+   R_nc_mark records the state of memory allocated by R_nc_alloc (or R_alloc)
+   and objects protected by R_nc_protect. R_nc_release reclaims memory
+   allocated since the mark and unprotects objects protected since the mark,
+   so results must be copied or inserted into a protected object beforehand.
+   Example:
+     R_nc_mark mark;
+     for (ii=0; ii<cnt; ii++) {
+       mark = R_nc_mark_get ();
+       ... temporary allocations ...
+       R_nc_release (mark);
+     }
+ */
+typedef struct {
+  void *vmax;
+  double used;
+  int nprotect;
+} R_nc_mark;
+
+R_nc_mark
+R_nc_mark_get (void);
+
+void
+R_nc_release (R_nc_mark mark);
+
+/* Unprotect objects protected since the mark, keeping memory allocations.
+ */
+void
+R_nc_release_protect (R_nc_mark mark);
+
+/* Categories of spans recorded by timeline tracing */
+typedef enum {
+  RNC_TRACE_CALL, RNC_TRACE_ATTR, RNC_TRACE_MODE, RNC_TRACE_IO,
+  RNC_TRACE_CONVERT
+} R_nc_trace_cat;
+
+/* Non-zero while timeline tracing is enabled */
+extern int R_nc_trace_on;
+
+/* Open a span in the timeline trace, nested inside any spans already open.
+   Result is a span number to be passed to R_nc_trace_end,
+   or -1 if tracing is disabled.
+ */
+int
+R_nc_trace_begin (const char *name, int cat);
+
+/* Close a span opened by R_nc_trace_begin, along with any spans nested in it.
+ */
+void
+R_nc_trace_end (int span);
+
+/* Close all open spans, marking them as terminated by an error.
+ */
+void
+R_nc_trace_unwind (void);
+
+/* Find attributes related to missing values for a netcdf variable,
+   as described in variable.c.
+ */
+void
+R_nc_miss_att (int ncid, int varid, int mode,
+               void **fill, void **min, void **max);
+
+/* Find packing attributes for a netcdf variable, as described in variable.c.
+ */
+void
+R_nc_pack_att (int ncid, int varid, double **scale, double **add);
+
+/* Find quantization of a netcdf variable, as described in variable.c.
+ */
+void
+R_nc_quantize_inq (int ncid, int varid, int *mode, int *nsd);
+
+/* Access patterns for the choice of chunk shapes */
+typedef enum {
+  RNC_CHUNK_BALANCED, RNC_CHUNK_TIMESERIES, RNC_CHUNK_MAP
+} R_nc_chunk_pattern;
+
+/* Default size of chunks chosen by R_nc_chunk_auto (bytes) */
+#define RNC_CHUNK_TARGET 4194304
+
+/* Size of blocks of records written by R_nc_put_var for compound types (bytes) */
+#define RNC_PUT_BLOCK 4194304
+
+/* Size of blocks of records read by R_nc_get_sparse (bytes) */
+#define RNC_GET_BLOCK 4194304
+
+/* Size of blocks of compound data packed by R_nc_compound_pack (bytes) */
+#define RNC_PACK_BLOCK 65536
+
+/* Convert the label of an access pattern in an R string
+   to R_nc_chunk_pattern. Raise an error if the label is unknown.
+ */
+int
+R_nc_chunk_access (SEXP access);
+
+/* Find a chunk shape for a netcdf variable with elements of type xtype
+   and ndims dimensions (C order), as described in chunk.c.
+   Chunk lengths are stored in chunk (C order).
+ */
+void
+R_nc_chunk_auto (int ncid, nc_type xtype, int ndims, const int *dimids,
+                 int access, size_t target, size_t *chunk);
+
 /* Determine if a C string matches the first element of an R variable.
    Result is a logical value. */
 int
@@ -128,6 +301,83 @@ size_t
 R_nc_sizearg (SEXP size);
 
 
+/* Determine if a path names a local directory (not a URL),
+   which is opened as an NCZarr store. Result is a logical value.
+ */
+int
+R_nc_zarr_isdir (const char *path);
+
+
+/* Convert the path of a local directory to a URL for an NCZarr store.
+   URLs are returned unchanged, and other results are allocated by R_nc_alloc.
+ */
+const char *
+R_nc_zarr_url (const char *path);
+
+
+/* Read a slab of a variable from an NCZarr store in a local directory,
+   decoding the chunks directly with up to nthreads threads (0 for default).
+   Returns 1 if the data were read, or 0 if the data must be read through
+   the netcdf library instead.
+ */
+int
+R_nc_zarr_get_vara (int ncid, int varid, const size_t *start,
+                    const size_t *count, void *data, int nthreads);
+
+
+/* Determine if a URL names a remote dataset that is read through
+   the block cache (an http or https URL with "#mode=bytes"
+   while the cache is enabled). Result is a logical value.
+ */
+int
+R_nc_http_cached (const char *url);
+
+
+/* Open a remote dataset in memory, assembled from cached and fetched blocks.
+   Returns netcdf status. If no error occurs, ncid is set, and image is set
+   to the memory that must be freed (by free) after the dataset is closed.
+ */
+int
+R_nc_http_open (const char *url, int omode, int *ncid, void **image);
+
+
+/* Key of a read in the result cache, from the identity of the dataset
+   and the options of var.get.nc. Result is allocated by R_nc_alloc,
+   or NULL if the cache is disabled or the dataset is not a local file.
+ */
+char *
+R_nc_cache_key (int ncid, int varid, int ndims, const size_t *start,
+                const size_t *count, int rawchar, int fitnum, int namode,
+                int unpack);
+
+
+/* Find the result of a read in the cache.
+   Returns R_NilValue if the result is not cached.
+ */
+SEXP
+R_nc_cache_get (const char *key);
+
+
+/* Store the result of a read in the cache (if it has a supported type) */
+void
+R_nc_cache_put (const char *key, SEXP result);
+
+
+/* Find unlimited dimensions of a file or group.
+   Returns netcdf status. If no error occurs, nunlim is set,
+   and unlimids is set to an array allocated by R_alloc.
+ */
+int
+R_nc_unlimdims (int ncid, int *nunlim, int **unlimids);
+
+
+/* Determine if a dimension is unlimited in a file or group,
+   searching ancestor groups if necessary. Result is a logical value.
+ */
+int
+R_nc_isunlim (int ncid, int dimid);
+
+
 /* Enter netcdf define mode if possible.
    Returns netcdf error code if an unhandled error occurs.
  */
@@ -143,4 +393,24 @@ int
 R_nc_enddef (int ncid);
 
 
+/* Update a 64-bit FNV-1a hash with size bytes of data.
+   Start with hash 0 to use the standard offset basis.
+ */
+unsigned long long
+R_nc_hash (unsigned long long hash, const void *data, size_t size);
+
+
+/* Delete the least recently modified files with names containing suffix
+   in directory dirname, until their total size is within limit (bytes).
+ */
+void
+R_nc_dir_trim (const char *dirname, const char *suffix, double limit);
+
+
+/* Register functions of the C interface (RNetCDFAPI.h) for other packages.
+ */
+void
+R_nc_api_init (void);
+
+
 #endif /* RNC_COMMON_H_INCLUDED */
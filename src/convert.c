@@ -144,6 +144,24 @@ R_nc_length_sexp (SEXP count)
 }
 
 
+/* Size in bytes of each element of an R vector type */
+static size_t
+R_nc_sizeof_sexp (SEXPTYPE type)
+{
+  switch (type) {
+  case RAWSXP:
+    return sizeof (Rbyte);
+  case LGLSXP:
+  case INTSXP:
+    return sizeof (int);
+  case REALSXP:
+    return sizeof (double);
+  default:
+    return sizeof (SEXP);
+  }
+}
+
+
 SEXP
 R_nc_allocArray (SEXPTYPE type, int ndims, const size_t *ccount) {
   SEXP result, rdim;
@@ -166,6 +184,7 @@ R_nc_allocArray (SEXPTYPE type, int ndims, const size_t *ccount) {
     /* R vector of length ccount[0] without a dimension attribute */
     result = R_nc_protect (allocVector (type, ccount[0]));
   }
+  R_nc_alloc_total += (double) xlength (result) * R_nc_sizeof_sexp (type);
   return result;
 }
 
@@ -196,7 +215,7 @@ R_nc_strsxp_char (SEXP rstr, int ndim, const size_t *xdim)
   if (xlength (rstr) < cnt) {
     RERROR (RNC_EDATALEN);
   }
-  carr = R_alloc (cnt*strlen, sizeof (char));
+  carr = R_nc_alloc (cnt*strlen, sizeof (char));
   for (ii=0, thisstr=carr; ii<cnt; ii++, thisstr+=strlen) {
     strncpy(thisstr, CHAR( STRING_ELT (rstr, ii)), strlen);
   }
@@ -214,7 +233,7 @@ R_nc_char_strsxp_init (R_nc_buf *io)
     io->rxp = R_nc_allocArray (STRSXP, 0, io->xdim);
   }
   if (!io->cbuf) {
-    io->cbuf = R_alloc (R_nc_length (io->ndim, io->xdim), sizeof (char));
+    io->cbuf = R_nc_alloc (R_nc_length (io->ndim, io->xdim), sizeof (char));
   }
 }
 
@@ -290,7 +309,7 @@ R_nc_strsxp_str (SEXP rstr, int ndim, const size_t *xdim)
   if (xlength (rstr) < cnt) {
     RERROR (RNC_EDATALEN);
   }
-  cstr = (const char **) R_alloc (cnt, sizeof(size_t));
+  cstr = (const char **) R_nc_alloc (cnt, sizeof(size_t));
   for (ii=0; ii<cnt; ii++) {
     cstr[ii] = CHAR( STRING_ELT (rstr, ii));
   }
@@ -303,7 +322,7 @@ R_nc_str_strsxp_init (R_nc_buf *io)
 {
   io->rxp = R_nc_allocArray (STRSXP, io->ndim, io->xdim);
   if (!io->cbuf) {
-    io->cbuf = R_alloc (xlength (io->rxp), sizeof(size_t));
+    io->cbuf = R_nc_alloc (xlength (io->rxp), sizeof(size_t));
   }
 }
 
@@ -370,7 +389,7 @@ FUN (SEXP rv, int ndim, const size_t *xdim, \
     RERROR (RNC_EDATALEN); \
   } \
   if (fill || scale || add || (NCITYPE != NCOTYPE)) { \
-    out = (OTYPE *) R_alloc (cnt, sizeof(OTYPE)); \
+    out = (OTYPE *) R_nc_alloc (cnt, sizeof(OTYPE)); \
   } else { \
     out = (OTYPE *) IFUN (rv); \
   } \
@@ -699,10 +718,13 @@ static nc_vlen_t *
 R_nc_vecsxp_vlen (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim,
                   const void *fill, const double *scale, const double *add)
 {
-  size_t ii, cnt, len, size;
+  size_t ii, cnt, len, size, basesize, total, offset;
   int baseclass;
   nc_type basetype;
   nc_vlen_t *vbuf;
+  char *pool=NULL;
+  const void *data;
+  R_nc_mark mark;
   SEXP item;
 
   cnt = R_nc_length (ndim, xdim);
@@ -717,8 +739,11 @@ R_nc_vecsxp_vlen (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim
     baseclass = NC_NAT;
     size = 0;
   }
+  R_nc_check (nc_inq_type (ncid, basetype, NULL, &basesize));
 
-  vbuf = (nc_vlen_t *) R_alloc (cnt, sizeof(nc_vlen_t));
+  /* Find the length of each element */
+  vbuf = (nc_vlen_t *) R_nc_alloc (cnt, sizeof(nc_vlen_t));
+  total = 0;
   for (ii=0; ii<cnt; ii++) {
     item = VECTOR_ELT(rv, ii);
     if (basetype == NC_CHAR && TYPEOF (item) == STRSXP) {
@@ -733,12 +758,56 @@ R_nc_vecsxp_vlen (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim
       len = xlength(item);
     }
     vbuf[ii].len = len;
+    vbuf[ii].p = NULL;
+    total += len;
+  }
+
+  /* Converted elements are copied into a single buffer, so that temporary
+     memory used by each conversion can be released.
+     The buffer is only needed if conversion of the first non-empty element
+     allocates memory (rather than using the R data directly),
+     and it cannot be used if elements may contain pointers to
+     temporary memory (nested vlen or compound types).
+   */
+  if (baseclass != NC_VLEN && baseclass != NC_COMPOUND) {
+    for (ii=0; ii<cnt; ii++) {
+      if (vbuf[ii].len > 0) {
+        mark = R_nc_mark_get ();
+        R_nc_r2c (VECTOR_ELT(rv, ii), ncid, basetype,
+                  -1, &(vbuf[ii].len), fill, scale, add);
+        if (R_nc_alloc_used > mark.used) {
+          R_nc_release (mark);
+          pool = R_nc_alloc (total, basesize);
+        } else {
+          R_nc_release (mark);
+        }
+        break;
+      }
+    }
+  }
+
+  /* Convert each element */
+  offset = 0;
+  for (ii=0; ii<cnt; ii++) {
+    len = vbuf[ii].len;
     if (len > 0) {
-      vbuf[ii].p = (void *) R_nc_r2c (item, ncid, basetype,
-                                      -1, &len, fill, scale, add);
-    } else {
-      vbuf[ii].p = NULL;
+      mark = R_nc_mark_get ();
+      data = R_nc_r2c (VECTOR_ELT(rv, ii), ncid, basetype,
+                       -1, &len, fill, scale, add);
+      if (R_nc_alloc_used <= mark.used) {
+        /* Result refers to R data */
+        vbuf[ii].p = (void *) data;
+        R_nc_release (mark);
+      } else if (pool) {
+        memcpy (pool + offset, data, len * basesize);
+        vbuf[ii].p = pool + offset;
+        R_nc_release (mark);
+      } else {
+        /* Keep temporary memory until the vlen array has been written */
+        vbuf[ii].p = (void *) data;
+      }
     }
+    offset += len * basesize;
   }
   return vbuf;
 }
@@ -756,7 +825,7 @@ R_nc_vlen_vecsxp_init (R_nc_buf *io)
 {
   io->rxp = R_nc_allocArray (VECSXP, io->ndim, io->xdim);
   if (!io->cbuf) {
-    io->cbuf = R_alloc (xlength (io->rxp), sizeof(nc_vlen_t));
+    io->cbuf = R_nc_alloc (xlength (io->rxp), sizeof(nc_vlen_t));
   }
 }
 
@@ -773,18 +842,128 @@ R_nc_vlen_vecsxp (R_nc_buf *io)
   nc_type basetype;
   nc_vlen_t *vbuf;
   R_nc_buf tmpio;
+  R_nc_mark mark;
 
   vbuf = io->cbuf;
   cnt = xlength (io->rxp);
   R_nc_check (nc_inq_user_type (io->ncid, io->xtype, NULL, NULL, &basetype, NULL, NULL));
 
   for (ii=0; ii<cnt; ii++) {
+    mark = R_nc_mark_get ();
     R_nc_c2r_init (&tmpio, vbuf[ii].p, io->ncid, basetype, -1, &(vbuf[ii].len),
                    io->rawchar, io->fitnum, io->fill, io->min, io->max,
                    io->scale, io->add);
     SET_VECTOR_ELT (io->rxp, ii, R_nc_c2r (&tmpio));
     nc_free_vlen(&(vbuf[ii]));
+    /* Element is protected by the list, so temporary memory can be released */
+    R_nc_release (mark);
+  }
+}
+
+
+nc_type
+R_nc_vlen_flat_base (int ncid, nc_type xtype, size_t *basesize)
+{
+  nc_type basetype;
+  R_nc_check (nc_inq_user_type (ncid, xtype, NULL, NULL, &basetype, NULL, NULL));
+  if (basetype > NC_MAX_ATOMIC_TYPE) {
+    R_nc_error ("Flat vlen arrays require an atomic base type");
+  }
+  R_nc_check (nc_inq_type (ncid, basetype, NULL, basesize));
+  return basetype;
+}
+
+
+SEXP
+R_nc_vlen_flat_c2r (int ncid, nc_type xtype, size_t cnt, nc_vlen_t *vbuf,
+                    int fitnum, const void *fill, const void *min,
+                    const void *max, const double *scale, const double *add)
+{
+  size_t ii, total, basesize;
+  nc_type basetype;
+  char *cbuf;
+  double *offsets;
+  R_nc_buf io;
+  SEXP result, roff;
+
+  basetype = R_nc_vlen_flat_base (ncid, xtype, &basesize);
+
+  result = R_nc_protect (allocVector (VECSXP, 2));
+  roff = allocVector (REALSXP, cnt+1);
+  SET_VECTOR_ELT (result, 1, roff);
+  offsets = REAL (roff);
+
+  total = 0;
+  for (ii=0; ii<cnt; ii++) {
+    offsets[ii] = total;
+    total += vbuf[ii].len;
+  }
+  offsets[cnt] = total;
+
+  /* Gather all elements into one buffer, then convert the values in a single
+     pass. Strings are freed by the conversion, and the vlen elements after
+     they are copied. Characters are returned as raw bytes,
+     because strings have no natural length within the buffer.
+   */
+  cbuf = R_nc_c2r_init (&io, NULL, ncid, basetype, -1, &total,
+                        1, fitnum, fill, min, max, scale, add);
+  for (ii=0; ii<cnt; ii++) {
+    if (vbuf[ii].len > 0) {
+      memcpy (cbuf + (size_t) offsets[ii] * basesize, vbuf[ii].p,
+              vbuf[ii].len * basesize);
+    }
+    nc_free_vlen(&(vbuf[ii]));
   }
+  SET_VECTOR_ELT (result, 0, R_nc_c2r (&io));
+
+  return result;
+}
+
+
+const nc_vlen_t *
+R_nc_vlen_flat_r2c (SEXP values, SEXP offsets, int ncid, nc_type xtype,
+                    int ndim, const size_t *xdim, const void *fill,
+                    const double *scale, const double *add)
+{
+  size_t ii, cnt, total, basesize;
+  nc_type basetype;
+  nc_vlen_t *vbuf;
+  const char *data;
+  const double *off;
+
+  basetype = R_nc_vlen_flat_base (ncid, xtype, &basesize);
+
+  cnt = R_nc_length (ndim, xdim);
+  if (!isReal (offsets) || (size_t) xlength (offsets) < cnt+1) {
+    RERROR (RNC_EDATALEN);
+  }
+  off = REAL (offsets);
+
+  if (basetype == NC_CHAR && TYPEOF (values) != RAWSXP) {
+    R_nc_error ("Flat vlen arrays of characters require raw values");
+  }
+  total = xlength (values);
+  for (ii=0; ii<=cnt; ii++) {
+    if (off[ii] != floor (off[ii])) {
+      R_nc_error ("Offsets of flat vlen array must be whole numbers");
+    }
+  }
+  for (ii=0; ii<cnt; ii++) {
+    if (!(off[ii] >= 0 && off[ii] <= off[ii+1] && off[ii+1] <= total)) {
+      R_nc_error ("Offsets of flat vlen array must be increasing within values");
+    }
+  }
+
+  /* Convert all values in a single pass,
+     then point the vlen elements into the converted buffer */
+  data = (const char *) R_nc_r2c (values, ncid, basetype, -1, &total,
+                                  fill, scale, add);
+  vbuf = (nc_vlen_t *) R_nc_alloc (cnt, sizeof(nc_vlen_t));
+  for (ii=0; ii<cnt; ii++) {
+    vbuf[ii].len = (size_t) (off[ii+1] - off[ii]);
+    vbuf[ii].p = (void *) (data + (size_t) off[ii] * basesize);
+  }
+  return vbuf;
 }
 
 
@@ -825,7 +1004,7 @@ R_nc_opaque_raw_init (R_nc_buf *io)
      */
     ndim = 1;
   }
-  xdim = (size_t *) R_alloc (ndim + 1, sizeof(size_t));
+  xdim = (size_t *) R_nc_alloc (ndim + 1, sizeof(size_t));
   memcpy (xdim, io->xdim, ndim * sizeof(size_t));
   xdim[ndim] = size;
 
@@ -873,7 +1052,7 @@ R_nc_factor_enum (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim
 
   nlev = xlength (levels);
 
-  levnames = (const char **) R_alloc (nlev, sizeof(size_t));
+  levnames = (const char **) R_nc_alloc (nlev, sizeof(size_t));
 
   for (ilev=0; ilev<nlev; ilev++) {
     levnames[ilev] = CHAR( STRING_ELT (levels, ilev));
@@ -882,8 +1061,8 @@ R_nc_factor_enum (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim
   /* Read values and names of enum members */
   R_nc_check (nc_inq_enum(ncid, xtype, NULL, NULL, &size, &nmem));
 
-  memnames = R_alloc (nmem, NC_MAX_NAME+1);
-  memvals = R_alloc (nmem, size);
+  memnames = R_nc_alloc (nmem, NC_MAX_NAME+1);
+  memvals = R_nc_alloc (nmem, size);
 
   for (imem=0, memname=memnames, memval=memvals; imem<nmem;
        imem++, memname+=(NC_MAX_NAME+1), memval+=size) {
@@ -891,7 +1070,7 @@ R_nc_factor_enum (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim
   }
 
   /* Find enum member for each R level */
-  ilev2mem = (size_t *) R_alloc (nlev, sizeof(size_t));
+  ilev2mem = (size_t *) R_nc_alloc (nlev, sizeof(size_t));
 
   for (ilev=0; ilev<nlev; ilev++) {
     ismatch = 0;
@@ -910,7 +1089,7 @@ R_nc_factor_enum (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim
 
   /* Convert factor indices to enum values */
   nfac = xlength (rv);
-  out = R_alloc (nfac, size);
+  out = R_nc_alloc (nfac, size);
 
   for (ifac=0; ifac<nfac; ifac++) {
     inval = in[ifac];
@@ -936,7 +1115,7 @@ R_nc_enum_factor_init (R_nc_buf *io)
   io->rbuf = INTEGER (io->rxp);
   if (!io->cbuf) {
     R_nc_check (nc_inq_type (io->ncid, io->xtype, NULL, &size));
-    io->cbuf = R_alloc (xlength (io->rxp), size);
+    io->cbuf = R_nc_alloc (xlength (io->rxp), size);
   }
 }
 
@@ -984,9 +1163,9 @@ R_nc_enum_factor (R_nc_buf *io)
   env = R_nc_protect (eval(lang1(install("new.env")),R_BaseEnv));
 
   levels = R_nc_allocArray (STRSXP, -1, &nmem);
-  memname = R_alloc (nmem, NC_MAX_NAME+1);
-  memval = R_alloc (1, size);
-  work = R_alloc (2*size+2, 1);
+  memname = R_nc_alloc (nmem, NC_MAX_NAME+1);
+  memval = R_nc_alloc (1, size);
+  work = R_nc_alloc (2*size+2, 1);
 
   imemmax = nmem; // netcdf member index is int
   for (imem=0; imem<imemmax; imem++) {
@@ -1035,25 +1214,37 @@ R_nc_enum_factor (R_nc_buf *io)
 
 /* -- Compound class -- */
 
-/* Convert list of arrays from R to netcdf compound type.
-   Memory for the result is allocated (and freed by R).
+/* Fields of a compound type prepared by R_nc_compound_packer.
+   Each field has len bytes per element of the compound array,
+   stored at offset bytes from the start of the element.
  */
-static void *
-R_nc_vecsxp_compound (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim)
+typedef struct {
+  size_t offset, len;
+  const char *buf;
+} R_nc_cmpfld;
+
+struct R_nc_packer {
+  size_t size, nfld;
+  R_nc_cmpfld *fld;
+};
+
+
+R_nc_packer *
+R_nc_compound_packer (SEXP rv, int ncid, nc_type xtype,
+                      int ndim, const size_t *xdim)
 {
-  size_t cnt, size, nfld, offset, fldsize, fldcnt, fldlen,
-         nlist, ilist, ielem, *dimsizefld;
+  size_t cnt, size, nfld, fldsize, fldcnt, nlist, ilist, *dimsizefld;
   nc_type typefld;
-  int ifldmax, ifld, idimfld, ndimfld, *dimlenfld, ismatch;
-  char *bufout, namefld[NC_MAX_NAME+1];
-  const char *buffld;
-  void *highwater;
+  int ifld, idimfld, ndimfld, *dimlenfld, ismatch;
+  char namefld[NC_MAX_NAME+1];
+  R_nc_packer *packer;
+  R_nc_cmpfld *fld;
   SEXP namelist;
 
   /* Get size and number of fields in compound type */
   R_nc_check (nc_inq_compound(ncid, xtype, NULL, &size, &nfld));
 
-  /* Check names attribute of R list */
+  /* Check names attribute of R list (or data frame) */
   namelist = getAttrib (rv, R_NamesSymbol);
   if (!isString (namelist)) {
     R_nc_error ("Named list required for conversion to compound type");
@@ -1063,26 +1254,19 @@ R_nc_vecsxp_compound (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *
     R_nc_error ("Not enough fields in list for conversion to compound type");
   }
 
-  /* Allocate memory for compound array,
-     filling with zeros so that valgrind does not complain about
-     uninitialised values in gaps inserted for alignment */
-  cnt = R_nc_length (ndim, xdim);
-  bufout = R_alloc (cnt, size);
-  memset(bufout, 0, cnt*size);
+  packer = (R_nc_packer *) R_nc_alloc (1, sizeof (R_nc_packer));
+  packer->size = size;
+  packer->nfld = nfld;
+  packer->fld = (R_nc_cmpfld *) R_nc_alloc (nfld, sizeof (R_nc_cmpfld));
 
-  /* Convert each field in turn */
-  ifldmax = nfld;
-  for (ifld=0; ifld<ifldmax; ifld++) {
-
-    /* Save memory "highwater mark" to reclaim memory from R_alloc,
-       which may consume large chunks of memory after R_nc_r2c.
-     */
-    highwater = vmaxget();
+  cnt = R_nc_length (ndim, xdim);
+  for (ifld=0; ifld<(int) nfld; ifld++) {
+    fld = &packer->fld[ifld];
 
     /* Query the dataset for details of the field. */
     R_nc_check (nc_inq_compound_field (ncid, xtype, ifld, namefld,
-                  &offset, &typefld, &ndimfld, NULL));
-    dimlenfld = (int *) R_alloc (ndimfld, sizeof(int));
+                  &fld->offset, &typefld, &ndimfld, NULL));
+    dimlenfld = (int *) R_nc_alloc (ndimfld, sizeof(int));
     R_nc_check (nc_inq_compound_fielddim_sizes(ncid, xtype, ifld, dimlenfld));
     R_nc_check (nc_inq_type (ncid, typefld, NULL, &fldsize));
 
@@ -1090,7 +1274,7 @@ R_nc_vecsxp_compound (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *
     ismatch = 0;
     for (ilist=0; ilist<nlist; ilist++) {
       if (strcmp (CHAR (STRING_ELT (namelist, ilist)), namefld) == 0) {
-        // ilist is the matching list index
+        /* ilist is the matching list index */
         ismatch = 1;
         break;
       }
@@ -1102,26 +1286,107 @@ R_nc_vecsxp_compound (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *
     /* Convert the field from R to C.
        Convert the dimension lengths from integer to size_t,
        adding an extra dimension (slowest varying) for the total number
-       of elements in the compound array (cnt). */
-    dimsizefld = (size_t *) R_alloc (ndimfld+1, sizeof(size_t));
+       of elements in the compound array (cnt).
+       Fields that need no conversion are used in place by R_nc_r2c. */
+    dimsizefld = (size_t *) R_nc_alloc (ndimfld+1, sizeof(size_t));
     dimsizefld[0] = cnt;
     for (idimfld=0; idimfld<ndimfld; idimfld++) {
       dimsizefld[idimfld+1] = dimlenfld[idimfld];
     }
-    buffld = R_nc_r2c (VECTOR_ELT (rv, ilist), ncid, typefld, ndimfld+1, dimsizefld,
-                       NULL, NULL, NULL);
-
-    /* Copy elements from the field array into the compound array */
+    fld->buf = R_nc_r2c (VECTOR_ELT (rv, ilist), ncid, typefld,
+                         ndimfld+1, dimsizefld, NULL, NULL, NULL);
     fldcnt = R_nc_length (ndimfld, dimsizefld+1);
-    fldlen = fldsize * fldcnt;
-    for (ielem=0; ielem<cnt; ielem++) {
-      memcpy (bufout+ielem*size+offset, buffld+ielem*fldlen, fldlen);
-    }
+    fld->len = fldsize * fldcnt;
+  }
 
-    /* Allow memory from R_alloc since vmaxget to be reclaimed */
-    vmaxset (highwater);
+  return packer;
+}
+
+
+size_t
+R_nc_compound_size (const R_nc_packer *packer)
+{
+  return packer->size;
+}
+
+
+/* Copy nelem values of a field with LEN bytes per element.
+   A constant LEN allows the compiler to replace memcpy by a single move.
+ */
+#define R_NC_PACK_FIELD(LEN) \
+  for (ii=0; ii<nblk; ii++) { \
+    memcpy (out+ii*size, in+ii*(LEN), (LEN)); \
   }
 
+void
+R_nc_compound_pack (const R_nc_packer *packer, size_t ielem, size_t nelem,
+                    void *buf)
+{
+  size_t size, nfld, ifld, len, iblk, nblk, maxblk, ii;
+  const R_nc_cmpfld *fld;
+  const char *in;
+  char *out;
+
+  /* Fill rows in blocks of about RNC_PACK_BLOCK bytes,
+     so that each block of the output stays in cache while the fields
+     are copied into it, rather than making a full pass for each field.
+   */
+  size = packer->size;
+  nfld = packer->nfld;
+  maxblk = (size < RNC_PACK_BLOCK) ? RNC_PACK_BLOCK / size : 1;
+  for (iblk=0; iblk<nelem; iblk+=nblk) {
+    nblk = (nelem - iblk < maxblk) ? nelem - iblk : maxblk;
+    for (ifld=0; ifld<nfld; ifld++) {
+      fld = &packer->fld[ifld];
+      len = fld->len;
+      in = fld->buf + (ielem+iblk)*len;
+      out = (char *) buf + iblk*size + fld->offset;
+      switch (len) {
+      case 1:
+        R_NC_PACK_FIELD(1);
+        break;
+      case 2:
+        R_NC_PACK_FIELD(2);
+        break;
+      case 4:
+        R_NC_PACK_FIELD(4);
+        break;
+      case 8:
+        R_NC_PACK_FIELD(8);
+        break;
+      case 16:
+        R_NC_PACK_FIELD(16);
+        break;
+      default:
+        R_NC_PACK_FIELD(len);
+      }
+    }
+  }
+}
+
+
+/* Convert list of arrays from R to netcdf compound type.
+   Memory for the result is allocated (and freed by R).
+ */
+static void *
+R_nc_vecsxp_compound (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim)
+{
+  size_t cnt, size;
+  char *bufout;
+  R_nc_packer *packer;
+
+  packer = R_nc_compound_packer (rv, ncid, xtype, ndim, xdim);
+
+  /* Allocate memory for compound array,
+     filling with zeros so that valgrind does not complain about
+     uninitialised values in gaps inserted for alignment */
+  cnt = R_nc_length (ndim, xdim);
+  size = R_nc_compound_size (packer);
+  bufout = R_nc_alloc (cnt, size);
+  memset(bufout, 0, cnt*size);
+
+  R_nc_compound_pack (packer, 0, cnt, bufout);
+
   return bufout;
 }
 
@@ -1152,7 +1417,7 @@ R_nc_compound_vecsxp_init (R_nc_buf *io)
   /* Allocate memory for compound array */
   if (!io->cbuf) {
     cnt = R_nc_length (io->ndim, io->xdim);
-    io->cbuf = R_alloc (cnt, size);
+    io->cbuf = R_nc_alloc (cnt, size);
   }
 }
 
@@ -1169,7 +1434,7 @@ R_nc_compound_vecsxp (R_nc_buf *io)
   SEXP namelist, rxpfld;
   char namefld[NC_MAX_NAME+1], *buffld, *bufcmp;
   R_nc_buf iofld;
-  void *highwater;
+  R_nc_mark mark;
 
   /* Get size and number of fields in compound type */
   ncid = io->ncid;
@@ -1186,15 +1451,15 @@ R_nc_compound_vecsxp (R_nc_buf *io)
   ifldmax = nfld;
   for (ifld=0; ifld<ifldmax; ifld++) {
 
-    /* Save memory "highwater mark" to reclaim memory from R_alloc,
-       which may consume large chunks of memory after R_nc_r2c.
+    /* Mark temporary memory, which may consume large chunks of memory
+       after R_nc_r2c or R_nc_c2r.
      */
-    highwater = vmaxget();
+    mark = R_nc_mark_get ();
 
     /* Query the dataset for details of the field. */
     R_nc_check (nc_inq_compound_field (ncid, xtype, ifld, namefld,
                   &offset, &typefld, &ndimfld, NULL));
-    dimlenfld = (int *) R_alloc (ndimfld, sizeof(int));
+    dimlenfld = (int *) R_nc_alloc (ndimfld, sizeof(int));
     R_nc_check (nc_inq_compound_fielddim_sizes(ncid, xtype, ifld, dimlenfld));
     R_nc_check (nc_inq_type (ncid, typefld, NULL, &fldsize));
 
@@ -1204,7 +1469,7 @@ R_nc_compound_vecsxp (R_nc_buf *io)
     /* Append field dimensions to the variable dimensions */
     ndim = io->ndim;
     ndimslice = ndim + ndimfld;
-    dimslice = (size_t *) R_alloc (ndimslice, sizeof(size_t));
+    dimslice = (size_t *) R_nc_alloc (ndimslice, sizeof(size_t));
     for (idim=0; idim<ndim; idim++) {
       dimslice[idim] = io->xdim[idim];
     }
@@ -1229,8 +1494,8 @@ R_nc_compound_vecsxp (R_nc_buf *io)
     /* Insert field data into R list */
     SET_VECTOR_ELT (io->rxp, ifld, rxpfld);
 
-    /* Allow memory from R_alloc since vmaxget to be reclaimed */
-    vmaxset (highwater);
+    /* Release temporary memory since the mark */
+    R_nc_release (mark);
   }
 }
 
@@ -1389,11 +1654,11 @@ R_nc_c2r_init (R_nc_buf *io, void *cbuf,
 
   if (xdim) {
     if (ndim > 0) {
-      io->xdim = (size_t *) R_alloc (ndim, sizeof(size_t));
+      io->xdim = (size_t *) R_nc_alloc (ndim, sizeof(size_t));
       memcpy (io->xdim, xdim, ndim*sizeof(size_t));
     } else if (ndim < 0) {
       /* Special case for vector without dim attribute */
-      io->xdim = (size_t *) R_alloc (1, sizeof(size_t));
+      io->xdim = (size_t *) R_nc_alloc (1, sizeof(size_t));
       memcpy (io->xdim, xdim, sizeof(size_t));
     }
     /* Scalar has no dimensions */
@@ -1404,27 +1669,27 @@ R_nc_c2r_init (R_nc_buf *io, void *cbuf,
   }
 
   if (fill) {
-    io->fill = R_alloc (1, size);
+    io->fill = R_nc_alloc (1, size);
     memcpy (io->fill, fill, size);
   }
 
   if (min) {
-    io->min = R_alloc (1, size);
+    io->min = R_nc_alloc (1, size);
     memcpy (io->min, min, size);
   }
 
   if (max) {
-    io->max = R_alloc (1, size);
+    io->max = R_nc_alloc (1, size);
     memcpy (io->max, max, size);
   }
 
   if (scale) {
-    io->scale = (double *) R_alloc (1, sizeof(double));
+    io->scale = (double *) R_nc_alloc (1, sizeof(double));
     *(io->scale) = *scale;
   }
 
   if (add) {
-    io->add = (double *) R_alloc (1, sizeof(double));
+    io->add = (double *) R_nc_alloc (1, sizeof(double));
     *(io->add) = *add;
   }
 
@@ -1619,6 +1884,90 @@ R_nc_c2r (R_nc_buf *io)
 }
 
 
+/*=============================================================================*\
+ *  Quantization of floating-point data
+\*=============================================================================*/
+
+/* Number of bits per decimal digit */
+#define RNC_BITS_PER_DIGIT 3.32192809488736234787
+
+/* Quantize an array of floating-point values in place,
+   following the algorithms of nc_def_var_quantize in netcdf-4.9.
+   TYPE is float or double, UTYPE is an unsigned integer of the same size,
+   and MANT is the number of explicit mantissa bits.
+   Values equal to fill, zero or non-finite values are not modified.
+ */
+#define R_NC_QUANTIZE(FUN, TYPE, UTYPE, MANT) \
+static void \
+FUN (TYPE *data, size_t cnt, int mode, int nsd, const TYPE *fill) \
+{ \
+  size_t ii; \
+  int keep, zero, expo, qpwr; \
+  UTYPE mask; \
+  union { TYPE f; UTYPE u; } val; \
+  if (mode == NC_QUANTIZE_BITGROOM) { \
+    keep = (int) ceil (nsd * RNC_BITS_PER_DIGIT) + 1; \
+  } else { \
+    keep = nsd; \
+  } \
+  zero = MANT - keep; \
+  mask = ~((UTYPE) 0) << ((zero > 0) ? zero : 0); \
+  for (ii=0; ii<cnt; ii++) { \
+    val.f = data[ii]; \
+    if (val.f == 0 || !R_FINITE (val.f) || (fill && val.f == *fill)) { \
+      continue; \
+    } \
+    if (mode == NC_QUANTIZE_GRANULARBR) { \
+      /* Keep bits down to the power of 2 below the last significant digit */ \
+      frexp (val.f, &expo); \
+      qpwr = (int) floor (RNC_BITS_PER_DIGIT * \
+               (floor (log10 (fabs (val.f))) + 1 - nsd)); \
+      zero = MANT - (expo - qpwr - 1); \
+      if (zero > MANT) { \
+        zero = MANT; \
+      } \
+      mask = ~((UTYPE) 0) << ((zero > 0) ? zero : 0); \
+    } \
+    if (zero <= 0) { \
+      continue; \
+    } \
+    if (mode == NC_QUANTIZE_BITGROOM) { \
+      /* Alternately shave and set trailing bits */ \
+      if (ii % 2 == 0) { \
+        val.u &= mask; \
+      } else { \
+        val.u |= ~mask; \
+      } \
+    } else { \
+      /* Round to nearest, then shave trailing bits */ \
+      val.u += ((UTYPE) 1) << (zero - 1); \
+      val.u &= mask; \
+    } \
+    data[ii] = val.f; \
+  } \
+}
+
+R_NC_QUANTIZE (R_nc_quantize_float, float, uint32_t, FLT_MANT_DIG-1)
+R_NC_QUANTIZE (R_nc_quantize_dbl, double, uint64_t, DBL_MANT_DIG-1)
+
+
+void
+R_nc_quantize (void *data, nc_type xtype, size_t cnt, int mode, int nsd,
+               const void *fill)
+{
+  switch (xtype) {
+  case NC_FLOAT:
+    R_nc_quantize_float (data, cnt, mode, nsd, fill);
+    break;
+  case NC_DOUBLE:
+    R_nc_quantize_dbl (data, cnt, mode, nsd, fill);
+    break;
+  default:
+    R_nc_error ("Quantization requires a floating-point type");
+  }
+}
+
+
 /*=============================================================================*\
  *  Dimension conversions
 \*=============================================================================*/
@@ -1658,7 +2007,7 @@ FUN (SEXP rv, size_t N, TYPE fillval) \
   size_t nr, ii; \
 \
   /* Allocate new C vector (freed by R) */ \
-  cv = (TYPE *) R_alloc (N, sizeof (TYPE)); \
+  cv = (TYPE *) R_nc_alloc (N, sizeof (TYPE)); \
 \
   /* Number of elements to copy must not exceed N */ \
   nr = xlength (rv); \
@@ -54,17 +54,11 @@ SEXP
 R_nc_allocArray (SEXPTYPE type, int ndims, const size_t *ccount);
 
 
-/* Structure whose members are used by R_nc_c2r_init and R_nc_c2r.
-   Other functions should not access members directly. */
-typedef struct {
-  SEXP rxp;
-  void *cbuf, *rbuf;
-  nc_type xtype;
-  int ncid, ndim, rawchar, fitnum;
-  size_t *xdim;
-  void *fill, *min, *max;
-  double *scale, *add;
-  } R_nc_buf;
+/* Structure R_nc_buf, whose members are used by R_nc_c2r_init and R_nc_c2r,
+   is defined in the public header of the C interface.
+ */
+#define RNETCDF_API_INTERNAL
+#include "RNetCDFAPI.h"
 
 
 /* Convert an R vector to a netcdf external type (xtype).
@@ -81,6 +75,40 @@ R_nc_r2c (SEXP rv, int ncid, nc_type xtype, int ndim, const size_t *xdim,
           const void *fill, const double *scale, const double *add);
 
 
+/* Pack a compound array from a named list (or data frame) of R arrays.
+   R_nc_compound_packer converts the fields of the compound type (xtype)
+   for an array with dimensions ndim and xdim (C-order), using the R data
+   in place where no conversion is needed.
+   R_nc_compound_pack copies nelem elements starting from element ielem
+   into buf, which has R_nc_compound_size bytes per element and should be
+   zeroed beforehand, because gaps for alignment are not written.
+   Memory is allocated by R_alloc (freed by R).
+ */
+typedef struct R_nc_packer R_nc_packer;
+
+R_nc_packer *
+R_nc_compound_packer (SEXP rv, int ncid, nc_type xtype,
+                      int ndim, const size_t *xdim);
+
+size_t
+R_nc_compound_size (const R_nc_packer *packer);
+
+void
+R_nc_compound_pack (const R_nc_packer *packer, size_t ielem, size_t nelem,
+                    void *buf);
+
+
+/* Quantize cnt elements of a floating-point array in place,
+   using a mode defined for nc_def_var_quantize (NC_QUANTIZE_BITGROOM,
+   NC_QUANTIZE_GRANULARBR or NC_QUANTIZE_BITROUND) and nsd significant
+   digits (or bits for NC_QUANTIZE_BITROUND). Elements equal to fill
+   (if not NULL) are unchanged.
+ */
+void
+R_nc_quantize (void *data, nc_type xtype, size_t cnt, int mode, int nsd,
+               const void *fill);
+
+
 /* Convert an array of netcdf external type (xtype) to R.
    Memory buffers for R and (optionally) C arrays are allocated by R_nc_c2r_init;
    the C to R conversion is performed by R_nc_c2r, and memory is freed by R.
@@ -107,6 +135,36 @@ SEXP
 R_nc_c2r (R_nc_buf *io);
 
 
+/* Convert vlen arrays of atomic base types between netcdf and a flat form
+   in R, which is a list of values (all elements concatenated) and offsets
+   (cnt+1 positions, 0-based, so that element ii has values
+   offsets[ii]+1 to offsets[ii+1] in R indices).
+   R_nc_vlen_flat_base returns the base type of vlen type xtype and its size,
+   raising an error unless the base type is atomic; it should be called
+   before elements are read, so that they are not leaked by the error.
+   R_nc_vlen_flat_c2r converts cnt elements read into vbuf, freeing memory
+   allocated by netcdf, and returns the list (protected by R_nc_protect).
+   NC_CHAR values are returned as raw bytes.
+   R_nc_vlen_flat_r2c converts R vector values and numeric vector offsets
+   to an array of nc_vlen_t with dimensions ndim and xdim (C-order),
+   pointing into a single buffer that is allocated by R_alloc
+   or refers to the R data.
+   Other arguments are as for R_nc_c2r_init and R_nc_r2c.
+ */
+nc_type
+R_nc_vlen_flat_base (int ncid, nc_type xtype, size_t *basesize);
+
+SEXP
+R_nc_vlen_flat_c2r (int ncid, nc_type xtype, size_t cnt, nc_vlen_t *vbuf,
+                    int fitnum, const void *fill, const void *min,
+                    const void *max, const double *scale, const double *add);
+
+const nc_vlen_t *
+R_nc_vlen_flat_r2c (SEXP values, SEXP offsets, int ncid, nc_type xtype,
+                    int ndim, const size_t *xdim, const void *fill,
+                    const double *scale, const double *add);
+
+
 /* Reverse a vector in-place.
    Example: R_nc_rev_int (cv, cnt);
  */
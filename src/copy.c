@@ -0,0 +1,930 @@
+/*=============================================================================*\
+ *
+ *  Name:       copy.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Copy NetCDF variables and datasets without conversion to R
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#ifdef HAVE_H5DGET_CHUNK_INFO
+#include <hdf5.h>
+#endif
+
+#include "common.h"
+#include "convert.h"
+#include "RNetCDF.h"
+
+
+/*=============================================================================*\
+ *  Private functions
+\*=============================================================================*/
+
+/* Options for storage of variables in the destination dataset.
+   Values of -1 imply that the setting is copied from the source variable.
+ */
+typedef struct {
+  int chunking; /* 0 - contiguous, 1 - chunked */
+  SEXP chunksizes; /* R order, or NULL for the source or default chunks */
+  int deflate; /* compression level 0-9 */
+  int shuffle; /* 0 or 1 */
+} R_nc_copy_opts;
+
+
+/* Convert storage options from R arguments */
+static void
+R_nc_copy_optarg (R_nc_copy_opts *opts, SEXP chunking, SEXP chunksizes,
+                  SEXP deflate, SEXP shuffle)
+{
+  int ival;
+
+  ival = asLogical (chunking);
+  opts->chunking = (ival == NA_LOGICAL) ? -1 : ival;
+
+  opts->chunksizes = isNull (chunksizes) ? NULL : chunksizes;
+
+  ival = asInteger (deflate);
+  if (ival == NA_INTEGER) {
+    opts->deflate = -1;
+  } else if (ival >= 0 && ival <= 9) {
+    opts->deflate = ival;
+  } else {
+    R_nc_error ("Compression level must be in the range 0 to 9");
+  }
+
+  ival = asLogical (shuffle);
+  opts->shuffle = (ival == NA_LOGICAL) ? -1 : ival;
+}
+
+
+/* Determine if a dataset uses the netcdf4 (hdf5) storage layer */
+static int
+R_nc_copy_ishdf5 (int ncid)
+{
+  int format;
+  R_nc_check (nc_inq_format (ncid, &format));
+  return (format == NC_FORMAT_NETCDF4 || format == NC_FORMAT_NETCDF4_CLASSIC);
+}
+
+
+/* Copy the definition of a type from one dataset to another,
+   unless a type with the same name already exists in the destination.
+   Atomic types are returned unchanged.
+ */
+static void
+R_nc_copy_type (int ncin, nc_type xin, int ncout, nc_type *xout)
+{
+  char name[NC_MAX_NAME+1], fldname[NC_MAX_NAME+1];
+  size_t size, nfld, ifld, offset;
+  nc_type basein, baseout, fldtype, *fldout;
+  int class, ndimfld, dimfld[NC_MAX_VAR_DIMS];
+  long long value;
+
+  if (xin <= NC_MAX_ATOMIC_TYPE) {
+    *xout = xin;
+    return;
+  }
+
+  R_nc_check (nc_inq_user_type (ncin, xin, name, &size, &basein, &nfld,
+                                &class));
+  if (nc_inq_typeid (ncout, name, xout) == NC_NOERR) {
+    return;
+  }
+
+  switch (class) {
+  case NC_VLEN:
+    R_nc_copy_type (ncin, basein, ncout, &baseout);
+    R_nc_check (nc_def_vlen (ncout, name, baseout, xout));
+    break;
+  case NC_OPAQUE:
+    R_nc_check (nc_def_opaque (ncout, size, name, xout));
+    break;
+  case NC_ENUM:
+    R_nc_check (nc_def_enum (ncout, basein, name, xout));
+    for (ifld=0; ifld<nfld; ifld++) {
+      R_nc_check (nc_inq_enum_member (ncin, xin, ifld, fldname, &value));
+      R_nc_check (nc_insert_enum (ncout, *xout, fldname, &value));
+    }
+    break;
+  case NC_COMPOUND:
+    /* Field types are defined before the compound type */
+    fldout = (nc_type *) R_alloc (nfld, sizeof (nc_type));
+    for (ifld=0; ifld<nfld; ifld++) {
+      R_nc_check (nc_inq_compound_field (ncin, xin, ifld, NULL, NULL,
+                                         &fldtype, NULL, NULL));
+      R_nc_copy_type (ncin, fldtype, ncout, &(fldout[ifld]));
+    }
+    R_nc_check (nc_def_compound (ncout, size, name, xout));
+    for (ifld=0; ifld<nfld; ifld++) {
+      R_nc_check (nc_inq_compound_field (ncin, xin, ifld, fldname, &offset,
+                                         NULL, &ndimfld, dimfld));
+      if (ndimfld > 0) {
+        R_nc_check (nc_insert_array_compound (ncout, *xout, fldname, offset,
+                                              fldout[ifld], ndimfld, dimfld));
+      } else {
+        R_nc_check (nc_insert_compound (ncout, *xout, fldname, offset,
+                                        fldout[ifld]));
+      }
+    }
+    break;
+  default:
+    R_nc_error (RNC_ETYPEDROP);
+  }
+}
+
+
+/* Define a dimension in the destination with the name, length and
+   unlimited status of a dimension in the source.
+   If lookup is true, an existing dimension with the same name is used.
+ */
+static int
+R_nc_copy_dim (int ncin, int dimin, int ncout, int lookup)
+{
+  char name[NC_MAX_NAME+1];
+  size_t len;
+  int dimout;
+
+  R_nc_check (nc_inq_dim (ncin, dimin, name, &len));
+  if (lookup && nc_inq_dimid (ncout, name, &dimout) == NC_NOERR) {
+    return dimout;
+  }
+  if (R_nc_isunlim (ncin, dimin)) {
+    len = NC_UNLIMITED;
+  }
+  R_nc_check (nc_def_dim (ncout, name, len, &dimout));
+  return dimout;
+}
+
+
+/* Define a variable in the destination (in define mode) like a variable
+   in the source, including its attributes and storage options.
+   Dimensions are found by name in the destination,
+   and missing dimensions and types are copied from the source.
+   Returns the id of the new variable.
+ */
+static int
+R_nc_copy_var_def (int ncin, int varin, int ncout, const char *name,
+                   const R_nc_copy_opts *opts)
+{
+  char srcname[NC_MAX_NAME+1], attname[NC_MAX_NAME+1];
+  int ndims, dimin[NC_MAX_VAR_DIMS], dimout[NC_MAX_VAR_DIMS], natts, iatt,
+      idim, varout, storage, shuffle, deflate, level, quantize;
+#if defined HAVE_DECL_NC_DEF_VAR_QUANTIZE && HAVE_DECL_NC_DEF_VAR_QUANTIZE
+  int qmode, qnsd;
+#endif
+  size_t *chunks;
+  nc_type xin, xout;
+
+  R_nc_check (nc_inq_var (ncin, varin, srcname, &xin, &ndims, dimin, &natts));
+  if (!name) {
+    name = srcname;
+  }
+
+  /*-- Define type, dimensions and variable ----------------------------------*/
+  R_nc_copy_type (ncin, xin, ncout, &xout);
+  for (idim=0; idim<ndims; idim++) {
+    dimout[idim] = R_nc_copy_dim (ncin, dimin[idim], ncout, 1);
+  }
+  R_nc_check (nc_def_var (ncout, name, xout, ndims, dimout, &varout));
+
+  /*-- Set storage options (netcdf4 only) ------------------------------------*/
+  if (ndims > 0 && R_nc_copy_ishdf5 (ncout)) {
+    chunks = (size_t *) R_alloc (ndims, sizeof (size_t));
+    storage = NC_CONTIGUOUS;
+    shuffle = 0;
+    deflate = 0;
+    level = 0;
+    if (R_nc_copy_ishdf5 (ncin)) {
+      R_nc_check (nc_inq_var_chunking (ncin, varin, &storage, chunks));
+      R_nc_check (nc_inq_var_deflate (ncin, varin, &shuffle, &deflate, &level));
+      if (!deflate) {
+        level = 0;
+      }
+    }
+
+    if (opts->chunksizes) {
+      if (length (opts->chunksizes) != ndims) {
+        R_nc_error ("Length of chunksizes must match number of dimensions");
+      }
+      chunks = R_nc_dim_r2c_size (opts->chunksizes, ndims, 0);
+      storage = NC_CHUNKED;
+    }
+    if (opts->chunking == 0) {
+      R_nc_check (nc_def_var_chunking (ncout, varout, NC_CONTIGUOUS, NULL));
+    } else if (storage == NC_CHUNKED) {
+      R_nc_check (nc_def_var_chunking (ncout, varout, NC_CHUNKED, chunks));
+    } else if (opts->chunking == 1) {
+      /* Use default chunk sizes from the netcdf library */
+      R_nc_check (nc_def_var_chunking (ncout, varout, NC_CHUNKED, NULL));
+    }
+
+    if (opts->deflate >= 0) {
+      level = opts->deflate;
+    }
+    if (opts->shuffle >= 0) {
+      shuffle = opts->shuffle;
+    }
+    if (level > 0 || shuffle) {
+      R_nc_check (nc_def_var_deflate (ncout, varout, shuffle, (level > 0),
+                                      level));
+    }
+  }
+
+  /*-- Copy quantization (netcdf4 only) --------------------------------------*/
+  quantize = 0;
+#if defined HAVE_DECL_NC_DEF_VAR_QUANTIZE && HAVE_DECL_NC_DEF_VAR_QUANTIZE
+  R_nc_quantize_inq (ncin, varin, &qmode, &qnsd);
+  if (qmode != NC_QUANTIZE_NOQUANTIZE && R_nc_copy_ishdf5 (ncout)) {
+    R_nc_check (nc_def_var_quantize (ncout, varout, qmode, qnsd));
+    quantize = 1;
+  }
+#endif
+
+  /*-- Copy attributes --------------------------------------------------------*/
+  for (iatt=0; iatt<natts; iatt++) {
+    R_nc_check (nc_inq_attname (ncin, varin, iatt, attname));
+    /* Quantization attributes are written by nc_def_var_quantize,
+       but they are copied as plain attributes to other formats */
+    if (quantize && strncmp (attname, "_Quantize", 9) == 0) {
+      continue;
+    }
+    R_nc_check (nc_copy_att (ncin, varin, attname, ncout, varout));
+  }
+
+  return varout;
+}
+
+
+/* Free memory allocated by the netcdf library within cnt elements of xtype,
+   including nested strings and vlens, but not the array of elements itself.
+ */
+static int
+R_nc_copy_reclaim (int ncid, nc_type xtype, void *data, size_t cnt)
+{
+#if defined HAVE_DECL_NC_RECLAIM_DATA && HAVE_DECL_NC_RECLAIM_DATA
+  return nc_reclaim_data (ncid, xtype, data, cnt);
+#else
+  int class, status, ndims, dimsizes[NC_MAX_VAR_DIMS], idim;
+  size_t xsize, nfld, ifld, offset, nelem, ii;
+  nc_type basetype;
+  nc_vlen_t *vlens;
+
+  if (xtype == NC_STRING) {
+    return nc_free_string (cnt, data);
+  } else if (xtype <= NC_MAX_ATOMIC_TYPE || cnt == 0) {
+    return NC_NOERR;
+  }
+
+  status = nc_inq_user_type (ncid, xtype, NULL, &xsize, &basetype, &nfld,
+                             &class);
+  if (status != NC_NOERR) return status;
+
+  if (class == NC_VLEN) {
+    vlens = data;
+    for (ii=0; ii<cnt; ii++) {
+      status = R_nc_copy_reclaim (ncid, basetype, vlens[ii].p, vlens[ii].len);
+      if (status != NC_NOERR) return status;
+      nc_free_vlen (&vlens[ii]);
+    }
+  } else if (class == NC_COMPOUND) {
+    for (ifld=0; ifld<nfld; ifld++) {
+      status = nc_inq_compound_field (ncid, xtype, ifld, NULL, &offset,
+                                      &basetype, &ndims, dimsizes);
+      if (status != NC_NOERR) return status;
+      if (basetype != NC_STRING && basetype <= NC_MAX_ATOMIC_TYPE) {
+        continue;
+      }
+      nelem = 1;
+      for (idim=0; idim<ndims; idim++) {
+        nelem *= dimsizes[idim];
+      }
+      for (ii=0; ii<cnt; ii++) {
+        status = R_nc_copy_reclaim (ncid, basetype,
+                                    (char *) data + ii * xsize + offset, nelem);
+        if (status != NC_NOERR) return status;
+      }
+    }
+  }
+  return NC_NOERR;
+#endif
+}
+
+
+#ifdef HAVE_H5DGET_CHUNK_INFO
+
+/* Maximum number of filter parameters that are compared */
+#define RNC_H5_MAXCD 32
+
+/* Open the HDF5 dataset of a variable in a netcdf4 dataset.
+   The file is opened again by HDF5, which shares the open file of netcdf.
+   Returns the dataset id and sets fileid, or returns a negative value
+   if the dataset cannot be opened.
+ */
+static hid_t
+R_nc_h5_open (int ncid, int varid, int write, hid_t *fileid)
+{
+  char *path, *dsetname, varname[NC_MAX_NAME+1];
+  size_t pathlen, grplen;
+  hid_t dsetid;
+
+  if (nc_inq_path (ncid, &pathlen, NULL) != NC_NOERR ||
+      nc_inq_grpname_full (ncid, &grplen, NULL) != NC_NOERR ||
+      nc_inq_varname (ncid, varid, varname) != NC_NOERR) {
+    return -1;
+  }
+  path = R_alloc (pathlen + 1, sizeof (char));
+  dsetname = R_alloc (grplen + strlen (varname) + 2, sizeof (char));
+  if (nc_inq_path (ncid, NULL, path) != NC_NOERR ||
+      nc_inq_grpname_full (ncid, NULL, dsetname) != NC_NOERR) {
+    return -1;
+  }
+  if (strcmp (dsetname, "/") != 0) {
+    strcat (dsetname, "/");
+  }
+  strcat (dsetname, varname);
+
+  *fileid = H5Fopen (path, write ? H5F_ACC_RDWR : H5F_ACC_RDONLY,
+                     H5P_DEFAULT);
+  if (*fileid < 0) {
+    return -1;
+  }
+  dsetid = H5Dopen2 (*fileid, dsetname, H5P_DEFAULT);
+  if (dsetid < 0) {
+    H5Fclose (*fileid);
+  }
+  return dsetid;
+}
+
+
+/* Check that two HDF5 datasets have the same fixed-size type,
+   chunk shape and filter pipeline, so that their chunks are interchangeable */
+static int
+R_nc_h5_same_layout (hid_t dsetin, hid_t dsetout)
+{
+  hid_t typein=-1, typeout=-1, plistin=-1, plistout=-1;
+  hsize_t chunkin[H5S_MAX_RANK], chunkout[H5S_MAX_RANK];
+  unsigned int flagsin, flagsout, cdin[RNC_H5_MAXCD], cdout[RNC_H5_MAXCD],
+               configin, configout;
+  size_t ncdin, ncdout;
+  int same=0, ndims, nfilt, ifilt;
+  H5Z_filter_t filtin, filtout;
+
+  typein = H5Dget_type (dsetin);
+  typeout = H5Dget_type (dsetout);
+  if (typein < 0 || typeout < 0 ||
+      H5Tequal (typein, typeout) <= 0 ||
+      H5Tdetect_class (typein, H5T_VLEN) != 0 ||
+      H5Tis_variable_str (typein) != 0) {
+    goto cleanup;
+  }
+
+  plistin = H5Dget_create_plist (dsetin);
+  plistout = H5Dget_create_plist (dsetout);
+  if (plistin < 0 || plistout < 0 ||
+      H5Pget_layout (plistin) != H5D_CHUNKED ||
+      H5Pget_layout (plistout) != H5D_CHUNKED) {
+    goto cleanup;
+  }
+
+  ndims = H5Pget_chunk (plistin, H5S_MAX_RANK, chunkin);
+  if (ndims < 0 || ndims != H5Pget_chunk (plistout, H5S_MAX_RANK, chunkout) ||
+      memcmp (chunkin, chunkout, ndims * sizeof (hsize_t)) != 0) {
+    goto cleanup;
+  }
+
+  nfilt = H5Pget_nfilters (plistin);
+  if (nfilt < 0 || nfilt != H5Pget_nfilters (plistout)) {
+    goto cleanup;
+  }
+  for (ifilt=0; ifilt<nfilt; ifilt++) {
+    ncdin = RNC_H5_MAXCD;
+    ncdout = RNC_H5_MAXCD;
+    filtin = H5Pget_filter2 (plistin, ifilt, &flagsin, &ncdin, cdin,
+                             0, NULL, &configin);
+    filtout = H5Pget_filter2 (plistout, ifilt, &flagsout, &ncdout, cdout,
+                              0, NULL, &configout);
+    if (filtin < 0 || filtin != filtout || ncdin != ncdout ||
+        ncdin > RNC_H5_MAXCD ||
+        memcmp (cdin, cdout, ncdin * sizeof (unsigned int)) != 0) {
+      goto cleanup;
+    }
+  }
+  same = 1;
+
+cleanup:
+  if (typein >= 0) H5Tclose (typein);
+  if (typeout >= 0) H5Tclose (typeout);
+  if (plistin >= 0) H5Pclose (plistin);
+  if (plistout >= 0) H5Pclose (plistout);
+  return same;
+}
+
+
+/* Copy the stored (compressed) chunks of a variable between netcdf4 datasets
+   using HDF5 direct chunk I/O, if both variables have interchangeable chunks.
+   Returns 1 if the data were copied, or 0 if the data must be copied through
+   the netcdf library instead (which overwrites any chunks written here).
+   On success, bytes is incremented by the uncompressed size of the data.
+ */
+static int
+R_nc_copy_var_raw (int ncin, int varin, int ncout, int varout, double *bytes)
+{
+  H5E_auto2_t errfunc;
+  void *errdata, *buf=NULL;
+  hid_t filein=-1, fileout=-1, dsetin=-1, dsetout=-1, space=-1;
+  hsize_t dims[H5S_MAX_RANK], dimsout[H5S_MAX_RANK], offset[H5S_MAX_RANK],
+          nchunk, ichunk, chunksize, bufsize=0;
+  haddr_t addr;
+  unsigned int filter;
+  int ndims, idim, dimids[NC_MAX_VAR_DIMS], unlim=0, span, status, done=0;
+  size_t xsize, len[NC_MAX_VAR_DIMS], index[NC_MAX_VAR_DIMS];
+  nc_type xtype;
+  double nelem;
+
+  if (!R_nc_copy_ishdf5 (ncin) || !R_nc_copy_ishdf5 (ncout)) {
+    return 0;
+  }
+
+  /*-- Extend unlimited dimensions of the destination through netcdf ---------*/
+  /* Writing the last element through netcdf extends the unlimited dimensions,
+     so that HDF5 never changes the extent of a dataset behind netcdf.
+     This re-encodes only one chunk, which is replaced if it is copied below. */
+  R_nc_check (nc_inq_var (ncin, varin, NULL, &xtype, &ndims, dimids, NULL));
+  R_nc_check (nc_inq_type (ncin, xtype, NULL, &xsize));
+  nelem = 1;
+  for (idim=0; idim<ndims; idim++) {
+    R_nc_check (nc_inq_dimlen (ncin, dimids[idim], &(len[idim])));
+    nelem *= len[idim];
+    index[idim] = (len[idim] > 0) ? len[idim] - 1 : 0;
+  }
+  R_nc_check (nc_inq_vardimid (ncout, varout, dimids));
+  for (idim=0; idim<ndims; idim++) {
+    unlim |= R_nc_isunlim (ncout, dimids[idim]);
+  }
+  if (unlim && nelem > 0) {
+    buf = R_alloc (1, xsize);
+    R_nc_check (nc_get_var1 (ncin, varin, index, buf));
+    status = nc_put_var1 (ncout, varout, index, buf);
+    R_nc_check (R_nc_copy_reclaim (ncin, xtype, buf, 1));
+    R_nc_check (status);
+    buf = NULL;
+  }
+  if (nc_sync (ncout) != NC_NOERR) {
+    return 0;
+  }
+
+  /* Failures are expected for unsuitable variables,
+     so HDF5 error messages are suppressed */
+  H5Eget_auto2 (H5E_DEFAULT, &errfunc, &errdata);
+  H5Eset_auto2 (H5E_DEFAULT, NULL, NULL);
+
+  /*-- Open and compare datasets ---------------------------------------------*/
+  dsetin = R_nc_h5_open (ncin, varin, 0, &filein);
+  if (dsetin < 0) goto cleanup;
+  dsetout = R_nc_h5_open (ncout, varout, 1, &fileout);
+  if (dsetout < 0) goto cleanup;
+  if (!R_nc_h5_same_layout (dsetin, dsetout)) goto cleanup;
+
+  /* Extents must already agree, because they are only changed by netcdf */
+  space = H5Dget_space (dsetin);
+  if (space < 0) goto cleanup;
+  ndims = H5Sget_simple_extent_dims (space, dims, NULL);
+  H5Sclose (space);
+  space = H5Dget_space (dsetout);
+  if (space < 0 || ndims < 0 ||
+      H5Sget_simple_extent_dims (space, dimsout, NULL) != ndims ||
+      memcmp (dims, dimsout, ndims * sizeof (hsize_t)) != 0) goto cleanup;
+
+  /*-- Copy allocated chunks --------------------------------------------------*/
+  if (H5Dget_num_chunks (dsetin, H5S_ALL, &nchunk) < 0) goto cleanup;
+  for (ichunk=0; ichunk<nchunk; ichunk++) {
+    if (H5Dget_chunk_info (dsetin, H5S_ALL, ichunk, offset, &filter,
+                           &addr, &chunksize) < 0) goto cleanup;
+    if (chunksize > bufsize) {
+      buf = R_Realloc (buf, chunksize, char);
+      bufsize = chunksize;
+    }
+    span = R_nc_trace_begin ("H5Dread_chunk", RNC_TRACE_IO);
+    if (H5Dread_chunk (dsetin, H5P_DEFAULT, offset, &filter, buf) < 0) {
+      R_nc_trace_end (span);
+      goto cleanup;
+    }
+    R_nc_trace_end (span);
+    span = R_nc_trace_begin ("H5Dwrite_chunk", RNC_TRACE_IO);
+    if (H5Dwrite_chunk (dsetout, H5P_DEFAULT, filter, offset, chunksize,
+                        buf) < 0) {
+      R_nc_trace_end (span);
+      goto cleanup;
+    }
+    R_nc_trace_end (span);
+  }
+  done = 1;
+
+cleanup:
+  R_Free (buf);
+  if (space >= 0) H5Sclose (space);
+  if (dsetin >= 0) H5Dclose (dsetin);
+  if (dsetout >= 0) H5Dclose (dsetout);
+  if (filein >= 0) H5Fclose (filein);
+  if (fileout >= 0) H5Fclose (fileout);
+  H5Eset_auto2 (H5E_DEFAULT, errfunc, errdata);
+
+  if (done) {
+    *bytes += nelem * xsize;
+  }
+  return done;
+}
+
+#endif /* HAVE_H5DGET_CHUNK_INFO */
+
+
+/* Copy data of a variable between datasets in blocks of up to bufsize bytes.
+   Blocks consist of whole chunks of the source variable where possible,
+   growing along the fastest-varying dimensions first.
+   Memory for the block is allocated by R_Calloc and freed before returning,
+   so errors are returned as a netcdf status rather than raised in R.
+   On exit, bytes is incremented by the number of bytes copied.
+ */
+static int
+R_nc_copy_var_data (int ncin, int varin, int ncout, int varout,
+                    size_t bufsize, double *bytes)
+{
+  int ndims, dimids[NC_MAX_VAR_DIMS], idim, class, storage, status, rstatus,
+      span;
+  size_t len[NC_MAX_VAR_DIMS], block[NC_MAX_VAR_DIMS],
+         start[NC_MAX_VAR_DIMS], count[NC_MAX_VAR_DIMS],
+         xsize, maxelem, nelem, cnt, factor, nblock;
+  nc_type xtype;
+  void *buf;
+
+  status = nc_inq_var (ncin, varin, NULL, &xtype, &ndims, dimids, NULL);
+  if (status != NC_NOERR) return status;
+  status = nc_inq_type (ncin, xtype, NULL, &xsize);
+  if (status != NC_NOERR) return status;
+#ifdef HAVE_H5DGET_CHUNK_INFO
+  if (R_nc_copy_var_raw (ncin, varin, ncout, varout, bytes)) {
+    return NC_NOERR;
+  }
+#endif
+
+  class = NC_NAT;
+  if (xtype > NC_MAX_ATOMIC_TYPE) {
+    status = nc_inq_user_type (ncin, xtype, NULL, NULL, NULL, NULL, &class);
+    if (status != NC_NOERR) return status;
+  }
+
+  /*-- Find shape of variable and its chunks ---------------------------------*/
+  storage = NC_CONTIGUOUS;
+  if (ndims > 0 && R_nc_copy_ishdf5 (ncin)) {
+    status = nc_inq_var_chunking (ncin, varin, &storage, block);
+    if (status != NC_NOERR) return status;
+  }
+  for (idim=0; idim<ndims; idim++) {
+    status = nc_inq_dimlen (ncin, dimids[idim], &(len[idim]));
+    if (status != NC_NOERR) return status;
+    if (len[idim] == 0) {
+      return NC_NOERR;
+    }
+    if (storage != NC_CHUNKED || block[idim] > len[idim]) {
+      block[idim] = (storage == NC_CHUNKED) ? len[idim] : 1;
+    }
+    start[idim] = 0;
+  }
+
+  /*-- Shape blocks to fit the buffer ----------------------------------------*/
+  maxelem = bufsize / xsize;
+  if (maxelem < 1) {
+    maxelem = 1;
+  }
+
+  nelem = R_nc_length (ndims, block);
+  for (idim=0; idim<ndims && nelem > maxelem; idim++) {
+    /* Chunks are larger than the buffer, so shrink the slowest dimensions */
+    nelem /= block[idim];
+    block[idim] = maxelem / nelem;
+    if (block[idim] < 1) {
+      block[idim] = 1;
+    }
+    nelem *= block[idim];
+  }
+
+  for (idim=ndims-1; idim>=0; idim--) {
+    /* Grow blocks by whole chunks, fastest dimensions first */
+    nblock = (len[idim] + block[idim] - 1) / block[idim];
+    factor = maxelem / nelem;
+    if (factor > nblock) {
+      factor = nblock;
+    }
+    if (factor > 1) {
+      nelem /= block[idim];
+      block[idim] *= factor;
+      if (block[idim] > len[idim]) {
+        block[idim] = len[idim];
+      }
+      nelem *= block[idim];
+    }
+  }
+
+  buf = R_Calloc (nelem * xsize, char);
+
+  /*-- Copy each block --------------------------------------------------------*/
+  while (1) {
+    for (idim=0; idim<ndims; idim++) {
+      count[idim] = len[idim] - start[idim];
+      if (count[idim] > block[idim]) {
+        count[idim] = block[idim];
+      }
+    }
+    cnt = R_nc_length (ndims, count);
+
+    span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
+    status = nc_get_vara (ncin, varin, start, count, buf);
+    R_nc_trace_end (span);
+    if (status != NC_NOERR) break;
+
+    span = R_nc_trace_begin ("nc_put_vara", RNC_TRACE_IO);
+    status = nc_put_vara (ncout, varout, start, count, buf);
+    R_nc_trace_end (span);
+
+    if (xtype == NC_STRING || class == NC_VLEN || class == NC_COMPOUND) {
+      rstatus = R_nc_copy_reclaim (ncin, xtype, buf, cnt);
+      if (status == NC_NOERR) {
+        status = rstatus;
+      }
+    }
+    if (status != NC_NOERR) break;
+
+    *bytes += (double) cnt * xsize;
+
+    /* Move to the next block, with the last dimension varying fastest */
+    for (idim=ndims-1; idim>=0; idim--) {
+      start[idim] += block[idim];
+      if (start[idim] < len[idim]) {
+        break;
+      }
+      start[idim] = 0;
+    }
+    if (idim < 0) {
+      break;
+    }
+  }
+
+  R_Free (buf);
+  return status;
+}
+
+
+/* Update counters of source and destination datasets */
+static void
+R_nc_copy_stats (SEXP nc_in, SEXP nc_out, double bytes, double time)
+{
+  R_nc_handle *handle;
+  handle = R_nc_handle_get (nc_in);
+  if (handle) {
+    handle->stats.get_calls++;
+    handle->stats.get_bytes += bytes;
+    handle->stats.io_time += time;
+  }
+  handle = R_nc_handle_get (nc_out);
+  if (handle) {
+    handle->stats.put_calls++;
+    handle->stats.put_bytes += bytes;
+  }
+}
+
+
+/* Define the contents of a group (or dataset) in the destination
+   like the source, recursing into sub-groups */
+static void
+R_nc_copy_grp_def (int ncin, int ncout, const R_nc_copy_opts *opts)
+{
+  int natts, iatt, ndims, *dimids, ntypes, *typeids, nvars, *varids,
+      ngrps, *grpids, ii, grpout;
+  nc_type xtype;
+  char name[NC_MAX_NAME+1];
+
+  /*-- Dimensions of this group ----------------------------------------------*/
+  R_nc_check (nc_inq_dimids (ncin, &ndims, NULL, 0));
+  dimids = (int *) R_alloc (ndims, sizeof (int));
+  R_nc_check (nc_inq_dimids (ncin, NULL, dimids, 0));
+  for (ii=0; ii<ndims; ii++) {
+    R_nc_copy_dim (ncin, dimids[ii], ncout, 0);
+  }
+
+  /*-- Types of this group ---------------------------------------------------*/
+  if (R_nc_copy_ishdf5 (ncin)) {
+    R_nc_check (nc_inq_typeids (ncin, &ntypes, NULL));
+    typeids = (int *) R_alloc (ntypes, sizeof (int));
+    R_nc_check (nc_inq_typeids (ncin, NULL, typeids));
+    for (ii=0; ii<ntypes; ii++) {
+      R_nc_copy_type (ncin, typeids[ii], ncout, &xtype);
+    }
+  }
+
+  /*-- Global attributes, after any types they use ---------------------------*/
+  R_nc_check (nc_inq_natts (ncin, &natts));
+  for (iatt=0; iatt<natts; iatt++) {
+    R_nc_check (nc_inq_attname (ncin, NC_GLOBAL, iatt, name));
+    R_nc_check (nc_copy_att (ncin, NC_GLOBAL, name, ncout, NC_GLOBAL));
+  }
+
+  /*-- Variables --------------------------------------------------------------*/
+  R_nc_check (nc_inq_varids (ncin, &nvars, NULL));
+  varids = (int *) R_alloc (nvars, sizeof (int));
+  R_nc_check (nc_inq_varids (ncin, NULL, varids));
+  for (ii=0; ii<nvars; ii++) {
+    R_nc_copy_var_def (ncin, varids[ii], ncout, NULL, opts);
+  }
+
+  /*-- Sub-groups -------------------------------------------------------------*/
+  if (R_nc_copy_ishdf5 (ncin)) {
+    R_nc_check (nc_inq_grps (ncin, &ngrps, NULL));
+    grpids = (int *) R_alloc (ngrps, sizeof (int));
+    R_nc_check (nc_inq_grps (ncin, NULL, grpids));
+    for (ii=0; ii<ngrps; ii++) {
+      R_nc_check (nc_inq_grpname (grpids[ii], name));
+      R_nc_check (nc_def_grp (ncout, name, &grpout));
+      R_nc_copy_grp_def (grpids[ii], grpout, opts);
+    }
+  }
+}
+
+
+/* Copy data of all variables in a group (or dataset) to the destination,
+   recursing into sub-groups */
+static void
+R_nc_copy_grp_data (int ncin, int ncout, size_t bufsize, double *bytes)
+{
+  int nvars, *varids, ngrps, *grpids, ii, varout, grpout;
+  char name[NC_MAX_NAME+1];
+
+  R_nc_check (nc_inq_varids (ncin, &nvars, NULL));
+  varids = (int *) R_alloc (nvars, sizeof (int));
+  R_nc_check (nc_inq_varids (ncin, NULL, varids));
+  for (ii=0; ii<nvars; ii++) {
+    R_nc_check (nc_inq_varname (ncin, varids[ii], name));
+    R_nc_check (nc_inq_varid (ncout, name, &varout));
+    R_nc_check (R_nc_copy_var_data (ncin, varids[ii], ncout, varout,
+                                    bufsize, bytes));
+  }
+
+  if (R_nc_copy_ishdf5 (ncin)) {
+    R_nc_check (nc_inq_grps (ncin, &ngrps, NULL));
+    grpids = (int *) R_alloc (ngrps, sizeof (int));
+    R_nc_check (nc_inq_grps (ncin, NULL, grpids));
+    for (ii=0; ii<ngrps; ii++) {
+      R_nc_check (nc_inq_grpname (grpids[ii], name));
+      R_nc_check (nc_inq_grp_ncid (ncout, name, &grpout));
+      R_nc_copy_grp_data (grpids[ii], grpout, bufsize, bytes);
+    }
+  }
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_copy_var()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_copy_var (SEXP nc_in, SEXP var_in, SEXP nc_out, SEXP name,
+               SEXP chunking, SEXP chunksizes, SEXP deflate, SEXP shuffle,
+               SEXP bufsize)
+{
+  int ncin, ncout, varin, varout;
+  const char *namep=NULL;
+  size_t cbufsize;
+  R_nc_copy_opts opts;
+  double bytes=0, time0;
+
+  /*-- Convert arguments to netcdf ids ----------------------------------------*/
+  ncin = asInteger (nc_in);
+  ncout = asInteger (nc_out);
+  R_nc_stats_meta (nc_out);
+
+  R_nc_check (R_nc_var_id (var_in, ncin, &varin));
+
+  if (!isNull (name)) {
+    namep = R_nc_strarg (name);
+  }
+
+  R_nc_copy_optarg (&opts, chunking, chunksizes, deflate, shuffle);
+  cbufsize = R_nc_sizearg (bufsize);
+
+  /*-- Define the variable in the destination ---------------------------------*/
+  R_nc_check (R_nc_redef (ncout));
+  varout = R_nc_copy_var_def (ncin, varin, ncout, namep, &opts);
+
+  /*-- Copy the data ----------------------------------------------------------*/
+  R_nc_check (R_nc_enddef (ncin));
+  R_nc_check (R_nc_enddef (ncout));
+  time0 = R_nc_timer ();
+  R_nc_check (R_nc_copy_var_data (ncin, varin, ncout, varout, cbufsize,
+                                  &bytes));
+  R_nc_copy_stats (nc_in, nc_out, bytes, R_nc_timer () - time0);
+
+  RRETURN(ScalarInteger (varout));
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_copy_file()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_copy_file (SEXP nc_in, SEXP nc_out, SEXP chunking, SEXP deflate,
+                SEXP shuffle, SEXP bufsize)
+{
+  int ncin, ncout;
+  size_t cbufsize;
+  R_nc_copy_opts opts;
+  double bytes=0, time0;
+
+  /*-- Convert arguments to netcdf ids ----------------------------------------*/
+  ncin = asInteger (nc_in);
+  ncout = asInteger (nc_out);
+  R_nc_stats_meta (nc_out);
+
+  R_nc_copy_optarg (&opts, chunking, R_NilValue, deflate, shuffle);
+  cbufsize = R_nc_sizearg (bufsize);
+
+  /*-- Define all groups before copying data, so that the header of a
+       classic dataset is only written once --------------------------------*/
+  R_nc_check (R_nc_redef (ncout));
+  R_nc_copy_grp_def (ncin, ncout, &opts);
+
+  /*-- Copy the data ----------------------------------------------------------*/
+  R_nc_check (R_nc_enddef (ncin));
+  R_nc_check (R_nc_enddef (ncout));
+  time0 = R_nc_timer ();
+  R_nc_copy_grp_data (ncin, ncout, cbufsize, &bytes);
+  R_nc_copy_stats (nc_in, nc_out, bytes, R_nc_timer () - time0);
+
+  RRETURN(R_NilValue);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_copy_schema()
+\*-----------------------------------------------------------------------------*/
+
+/* Define all groups, types, dimensions, variables and attributes of nc_in
+   in nc_out, without copying any data. The destination is left in define mode,
+   so that further definitions do not require another call of nc_redef.
+ */
+SEXP
+R_nc_copy_schema (SEXP nc_in, SEXP nc_out, SEXP chunking, SEXP deflate,
+                  SEXP shuffle)
+{
+  int ncin, ncout;
+  R_nc_copy_opts opts;
+
+  /*-- Convert arguments to netcdf ids ----------------------------------------*/
+  ncin = asInteger (nc_in);
+  ncout = asInteger (nc_out);
+  R_nc_stats_meta (nc_out);
+
+  R_nc_copy_optarg (&opts, chunking, R_NilValue, deflate, shuffle);
+
+  /*-- Define all groups in a single define-mode session ---------------------*/
+  R_nc_check (R_nc_redef (ncout));
+  R_nc_copy_grp_def (ncin, ncout, &opts);
+
+  RRETURN(R_NilValue);
+}
+
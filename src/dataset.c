@@ -88,19 +88,23 @@ R_nc_format2str (int format)
 SEXP
 R_nc_close (SEXP ptr)
 {
-  int *fileid;
+  R_nc_handle *handle;
 
   if (TYPEOF (ptr) != EXTPTRSXP) {
     RERROR ("Not a valid NetCDF object");
   }
 
-  fileid = R_ExternalPtrAddr (ptr);
-  if (!fileid) {
+  handle = R_ExternalPtrAddr (ptr);
+  if (!handle) {
     RRETURN(R_NilValue);
   }
 
-  R_nc_check (nc_close (*fileid));
-  R_Free (fileid);
+  R_nc_check (nc_close (handle->ncid));
+  free (handle->image);
+  if (handle->recdim) {
+    R_Free (handle->recdim);
+  }
+  R_Free (handle);
   R_ClearExternalPtr (ptr);
 
   RRETURN(R_NilValue);
@@ -123,7 +127,8 @@ SEXP
 R_nc_create (SEXP filename, SEXP clobber, SEXP share, SEXP prefill,
              SEXP format)
 {
-  int cmode, fillmode, old_fillmode, ncid, *fileid;
+  int cmode, fillmode, old_fillmode, ncid, iszarr=0;
+  R_nc_handle *handle;
   SEXP Rptr, result;
   const char *filep;
 
@@ -153,21 +158,33 @@ R_nc_create (SEXP filename, SEXP clobber, SEXP share, SEXP prefill,
     cmode = cmode | NC_NETCDF4 | NC_CLASSIC_MODEL;
   } else if (R_nc_strcmp(format, "offset64")) {
     cmode = cmode | NC_64BIT_OFFSET;
+  } else if (R_nc_strcmp(format, "nczarr")) {
+#ifdef NC_FORMATX_NCZARR
+    cmode = cmode | NC_NETCDF4;
+    iszarr = 1;
+#else
+    RERROR ("NCZarr is not supported by the netcdf library");
+#endif
   }
 
   /*-- Create the file --------------------------------------------------------*/
   filep = R_nc_strarg (filename);
   if (strlen (filep) > 0) {
-    R_nc_check (nc_create (R_ExpandFileName (filep), cmode, &ncid));
+    filep = R_ExpandFileName (filep);
+    if (iszarr) {
+      /* NCZarr stores are directories named by URLs */
+      filep = R_nc_zarr_url (filep);
+    }
+    R_nc_check (nc_create (filep, cmode, &ncid));
   } else {
     RERROR ("Filename must be a non-empty string");
   }
   result = R_nc_protect (ScalarInteger (ncid));
 
   /*-- Arrange for file to be closed if handle is garbage collected -----------*/
-  fileid = R_Calloc (1, int);
-  *fileid = ncid;
-  Rptr = R_nc_protect (R_MakeExternalPtr (fileid, R_NilValue, R_NilValue));
+  handle = R_Calloc (1, R_nc_handle);
+  handle->ncid = ncid;
+  Rptr = R_nc_protect (R_MakeExternalPtr (handle, R_NilValue, R_NilValue));
   R_RegisterCFinalizerEx (Rptr, &R_nc_finalizer, TRUE);
   setAttrib (result, install ("handle_ptr"), Rptr);
 
@@ -186,10 +203,14 @@ SEXP
 R_nc_inq_file (SEXP nc)
 {
   int ncid, ndims, nvars, ngatts, unlimdimid, format;
+#ifdef NC_FORMATX_NCZARR
+  int formatx;
+#endif
   SEXP result;
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   /*-- Inquire about the NetCDF dataset ---------------------------------------*/
   R_nc_check (nc_inq (ncid, &ndims, &nvars, &ngatts, &unlimdimid));
@@ -199,6 +220,9 @@ R_nc_inq_file (SEXP nc)
 
   /*-- Inquire about the NetCDF format ----------------------------------------*/
   R_nc_check (nc_inq_format (ncid, &format));
+#ifdef NC_FORMATX_NCZARR
+  R_nc_check (nc_inq_format_extended (ncid, &formatx, NULL));
+#endif
 
   /*-- Returning the list -----------------------------------------------------*/
   result = R_nc_protect (allocVector (VECSXP, 5)); 
@@ -206,6 +230,11 @@ R_nc_inq_file (SEXP nc)
   SET_VECTOR_ELT (result, 1, ScalarInteger (nvars));
   SET_VECTOR_ELT (result, 2, ScalarInteger (ngatts));
   SET_VECTOR_ELT (result, 3, ScalarInteger (unlimdimid));
+#ifdef NC_FORMATX_NCZARR
+  if (formatx == NC_FORMATX_NCZARR) {
+    SET_VECTOR_ELT (result, 4, mkString ("nczarr"));
+  } else
+#endif
   SET_VECTOR_ELT (result, 4, mkString (R_nc_format2str (format)));
 
   RRETURN(result);
@@ -216,11 +245,57 @@ R_nc_inq_file (SEXP nc)
  *  R_nc_open()
 \*-----------------------------------------------------------------------------*/
 
+/* Append the unlimited dimensions of a group and its descendants
+   to the list of record dimensions followed by a dataset handle.
+   Returns netcdf status. */
+static int
+R_nc_follow_init (R_nc_handle *handle, int ncid)
+{
+  int status, nunlim, *unlimids, ngrps, *grpids, ii;
+  size_t length;
+
+  status = R_nc_unlimdims (ncid, &nunlim, &unlimids);
+  if (status != NC_NOERR) {
+    return status;
+  }
+
+  for (ii=0; ii<nunlim; ii++) {
+    status = nc_inq_dimlen (ncid, unlimids[ii], &length);
+    if (status != NC_NOERR) {
+      return status;
+    }
+    handle->recdim = R_Realloc (handle->recdim, handle->nrecdim+1,
+                                R_nc_recdim);
+    handle->recdim[handle->nrecdim].grpid = ncid;
+    handle->recdim[handle->nrecdim].dimid = unlimids[ii];
+    handle->recdim[handle->nrecdim].length = length;
+    handle->nrecdim++;
+  }
+
+  status = nc_inq_grps (ncid, &ngrps, NULL);
+  if (status != NC_NOERR || ngrps == 0) {
+    return status;
+  }
+  grpids = (int *) R_alloc (ngrps, sizeof (int));
+  status = nc_inq_grps (ncid, NULL, grpids);
+  for (ii=0; ii<ngrps && status == NC_NOERR; ii++) {
+    status = R_nc_follow_init (handle, grpids[ii]);
+  }
+  return status;
+}
+
+
 SEXP
-R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill)
+R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill, SEXP threads,
+           SEXP follow)
 {
-  int ncid, omode, fillmode, old_fillmode, *fileid;
+  int ncid, omode, fillmode, old_fillmode, iszarr=0;
+#ifdef NC_FORMATX_NCZARR
+  int formatx;
+#endif
+  R_nc_handle *handle;
   const char *filep;
+  void *image=NULL;
   SEXP Rptr, result;
 
   /*-- Determine the omode ----------------------------------------------------*/
@@ -230,7 +305,13 @@ R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill)
     omode = NC_NOWRITE;
   }
 
-  if (asLogical(share) == TRUE) {
+  if (asLogical(follow) == TRUE) {
+    if (omode & NC_WRITE) {
+      RERROR ("Cannot follow a dataset opened for writing");
+    }
+    /* Records written by another process are not buffered by the reader */
+    omode = omode | NC_SHARE;
+  } else if (asLogical(share) == TRUE) {
     omode = omode | NC_SHARE;
   }
 
@@ -244,19 +325,51 @@ R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill)
   /*-- Open the file ----------------------------------------------------------*/
   filep = R_nc_strarg (filename);
   if (strlen (filep) > 0) {
-    R_nc_check (nc_open (R_ExpandFileName (filep), omode, &ncid));
+    filep = R_ExpandFileName (filep);
+    if (R_nc_zarr_isdir (filep)) {
+      /* Directories are opened as NCZarr stores */
+      filep = R_nc_zarr_url (filep);
+    }
+    if (R_nc_http_cached (filep) && !(omode & (NC_WRITE | NC_SHARE))) {
+      /* Remote datasets are assembled from cached blocks */
+      R_nc_check (R_nc_http_open (filep, omode, &ncid, &image));
+    } else {
+      R_nc_check (nc_open (filep, omode, &ncid));
+    }
   } else {
     RERROR ("Filename must be a non-empty string");
   }
+#ifdef NC_FORMATX_NCZARR
+  if (nc_inq_format_extended (ncid, &formatx, NULL) == NC_NOERR &&
+      formatx == NC_FORMATX_NCZARR) {
+    iszarr = 1;
+  }
+#endif
   result = R_nc_protect (ScalarInteger (ncid));
 
   /*-- Arrange for file to be closed if handle is garbage collected -----------*/
-  fileid = R_Calloc (1, int);
-  *fileid = ncid;
-  Rptr = R_nc_protect (R_MakeExternalPtr (fileid, R_NilValue, R_NilValue));
+  handle = R_Calloc (1, R_nc_handle);
+  handle->ncid = ncid;
+  handle->image = image;
+  handle->readonly = (asLogical(write) != TRUE);
+
+  /* Chunks of a read-only NCZarr store can be decoded directly,
+     because they are not cached in memory by the netcdf library */
+  handle->zarr = iszarr && (asLogical(write) != TRUE);
+  handle->threads = asInteger (threads);
+  if (handle->threads == NA_INTEGER || handle->threads < 0) {
+    handle->threads = 0;
+  }
+  Rptr = R_nc_protect (R_MakeExternalPtr (handle, R_NilValue, R_NilValue));
   R_RegisterCFinalizerEx (Rptr, &R_nc_finalizer, TRUE);
   setAttrib (result, install ("handle_ptr"), Rptr);
 
+  /*-- Record the lengths of unlimited dimensions in a followed dataset -------*/
+  if (asLogical(follow) == TRUE) {
+    handle->follow = 1;
+    R_nc_check (R_nc_follow_init (handle, ncid));
+  }
+
   /*-- Set the fill mode ------------------------------------------------------*/
   if (asLogical(write) == TRUE) {
     R_nc_check (nc_set_fill (ncid, fillmode, &old_fillmode));
@@ -266,6 +379,55 @@ R_nc_open (SEXP filename, SEXP write, SEXP share, SEXP prefill)
 }
 
 
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_refresh()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_refresh (SEXP nc)
+{
+  int ncid, ii;
+  size_t length;
+  R_nc_handle *handle;
+  SEXP result, dimids, previous, lengths;
+  int *idp;
+  double *prevp, *lenp;
+
+  handle = R_nc_handle_get (nc);
+  if (!handle || !handle->follow) {
+    RERROR ("Dataset was not opened with follow=TRUE");
+  }
+
+  /*-- Read the header of the dataset again -----------------------------------*/
+  ncid = asInteger(nc);
+  R_nc_stats_meta (nc);
+  R_nc_check (nc_sync (ncid));
+
+  /*-- Compare the unlimited dimensions with their previous lengths -----------*/
+  result = R_nc_protect (allocVector (VECSXP, 3));
+  dimids = allocVector (INTSXP, handle->nrecdim);
+  SET_VECTOR_ELT (result, 0, dimids);
+  previous = allocVector (REALSXP, handle->nrecdim);
+  SET_VECTOR_ELT (result, 1, previous);
+  lengths = allocVector (REALSXP, handle->nrecdim);
+  SET_VECTOR_ELT (result, 2, lengths);
+
+  idp = INTEGER (dimids);
+  prevp = REAL (previous);
+  lenp = REAL (lengths);
+  for (ii=0; ii<handle->nrecdim; ii++) {
+    R_nc_check (nc_inq_dimlen (handle->recdim[ii].grpid,
+                               handle->recdim[ii].dimid, &length));
+    idp[ii] = handle->recdim[ii].dimid;
+    prevp[ii] = handle->recdim[ii].length;
+    lenp[ii] = length;
+    handle->recdim[ii].length = length;
+  }
+
+  RRETURN(result);
+}
+
+
 /*-----------------------------------------------------------------------------*\
  *  R_nc_sync()
 \*-----------------------------------------------------------------------------*/
@@ -277,6 +439,7 @@ R_nc_sync (SEXP nc)
 
   /*-- Enter data mode (if necessary) -----------------------------------------*/
   ncid = asInteger(nc);
+  R_nc_stats_meta (nc);
   R_nc_check( R_nc_enddef (ncid));
 
   /*-- Sync the file ----------------------------------------------------------*/
@@ -285,3 +448,41 @@ R_nc_sync (SEXP nc)
   RRETURN(R_NilValue);
 }
 
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_inq_stats()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_inq_stats (SEXP nc, SEXP reset)
+{
+  R_nc_handle *handle;
+  R_nc_stats *stats;
+  SEXP result;
+
+  /*-- Find the counters of the dataset ---------------------------------------*/
+  handle = R_nc_handle_get (nc);
+  if (!handle) {
+    RERROR ("Not a valid NetCDF object");
+  }
+  stats = &(handle->stats);
+
+  /*-- Returning the list -----------------------------------------------------*/
+  result = R_nc_protect (allocVector (VECSXP, 9));
+  SET_VECTOR_ELT (result, 0, ScalarReal (stats->get_calls));
+  SET_VECTOR_ELT (result, 1, ScalarReal (stats->get_bytes));
+  SET_VECTOR_ELT (result, 2, ScalarReal (stats->put_calls));
+  SET_VECTOR_ELT (result, 3, ScalarReal (stats->put_bytes));
+  SET_VECTOR_ELT (result, 4, ScalarReal (stats->io_time));
+  SET_VECTOR_ELT (result, 5, ScalarReal (stats->convert_time));
+  SET_VECTOR_ELT (result, 6, ScalarReal (stats->meta_calls));
+  SET_VECTOR_ELT (result, 7, ScalarReal (stats->alloc_bytes));
+  SET_VECTOR_ELT (result, 8, ScalarReal (stats->peak_bytes));
+
+  /*-- Reset the counters (if requested) --------------------------------------*/
+  if (asLogical (reset) == TRUE) {
+    memset (stats, 0, sizeof (R_nc_stats));
+  }
+
+  RRETURN(result);
+}
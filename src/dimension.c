@@ -67,6 +67,7 @@ R_nc_def_dim (SEXP nc, SEXP dimname, SEXP size, SEXP unlim)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   dimnamep = R_nc_strarg (dimname);
 
@@ -91,12 +92,12 @@ R_nc_def_dim (SEXP nc, SEXP dimname, SEXP size, SEXP unlim)
  *  R_nc_inq_unlimids()
 \*-----------------------------------------------------------------------------*/
 
-/* Private function to find unlimited dimensions of a file or group.
+/* Find unlimited dimensions of a file or group.
    Returns netcdf status. If no error occurs, nunlim and unlimids are set.
    Note - some netcdf4 versions only return unlimited dimensions defined in a group,
      not those defined in the group and its ancestors as claimed in documentation.
  */
-static int
+int
 R_nc_unlimdims (int ncid, int *nunlim, int **unlimids)
 {
   int status, format;
@@ -130,6 +131,26 @@ R_nc_unlimdims (int ncid, int *nunlim, int **unlimids)
 }
 
 
+/* Determine if a dimension is unlimited,
+   searching ancestor groups if necessary */
+int
+R_nc_isunlim (int ncid, int dimid)
+{
+  int nunlim, *unlimids, ii, format;
+  do {
+    R_nc_check (R_nc_unlimdims (ncid, &nunlim, &unlimids));
+    for (ii=0; ii<nunlim; ii++) {
+      if (unlimids[ii] == dimid) {
+        return 1;
+      }
+    }
+    R_nc_check (nc_inq_format (ncid, &format));
+  } while (format == NC_FORMAT_NETCDF4 &&
+           nc_inq_grp_parent (ncid, &ncid) == NC_NOERR);
+  return 0;
+}
+
+
 SEXP
 R_nc_inq_unlimids (SEXP nc)
 {
@@ -137,6 +158,7 @@ R_nc_inq_unlimids (SEXP nc)
   SEXP result;
 
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   R_nc_check (R_nc_unlimdims (ncid, &nunlim, &unlimids));
 
@@ -166,6 +188,7 @@ R_nc_inq_dim (SEXP nc, SEXP dim)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   R_nc_check (R_nc_dim_id (dim, ncid, &dimid, 0));
 
@@ -207,6 +230,7 @@ R_nc_rename_dim (SEXP nc, SEXP dim, SEXP newname)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   R_nc_check (R_nc_dim_id (dim, ncid, &dimid, 0));
 
@@ -66,6 +66,7 @@ R_nc_def_grp (SEXP nc, SEXP grpname)
 
   /* Convert arguments to netcdf ids */
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   cgrpname = R_nc_strarg (grpname);
 
@@ -91,6 +92,7 @@ R_nc_inq_grp_parent (SEXP nc)
 
   /* Get parent group */
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
   R_nc_check (nc_inq_grp_parent (ncid, &grpid));
 
   result = R_nc_protect (ScalarInteger (grpid));
@@ -109,6 +111,7 @@ R_nc_inq_natts (SEXP nc)
 
   /* Get number of attributes in group */
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
   R_nc_check (nc_inq_natts (ncid, &natts));
 
   result = R_nc_protect (ScalarInteger (natts));
@@ -128,6 +131,7 @@ R_nc_inq_grpname (SEXP nc, SEXP full)
   SEXP result;
 
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   if (asLogical (full) == TRUE) {
     R_nc_check (nc_inq_grpname_full (ncid, &namelen, NULL));
@@ -156,6 +160,7 @@ R_nc_inq_grp_ncid (SEXP nc, SEXP grpname, SEXP full)
   SEXP result;
 
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
   cgrpname = R_nc_strarg (grpname);
 
   if (asLogical (full) == TRUE) {
@@ -180,6 +185,7 @@ SEXP RFUN (SEXP nc) \
   int    ncid, count; \
   SEXP result; \
   ncid = asInteger (nc); \
+  R_nc_stats_meta (nc); \
   R_nc_check(NCFUN(ncid, &count, NULL)); \
   result = R_nc_protect (allocVector (INTSXP, count)); \
   R_nc_check(NCFUN(ncid, NULL, INTEGER(result))); \
@@ -202,6 +208,7 @@ R_nc_inq_dimids (SEXP nc, SEXP ancestors)
   SEXP result;
 
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
   full = (asLogical (ancestors) == TRUE);
 
   R_nc_check (nc_inq_dimids (ncid, &count, NULL, full));
@@ -223,6 +230,7 @@ R_nc_rename_grp (SEXP nc, SEXP grpname)
   const char *cgrpname;
 
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
   cgrpname = R_nc_strarg (grpname);
 
   /* Enter define mode */
@@ -0,0 +1,528 @@
+/*=============================================================================*\
+ *
+ *  Name:       header.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Read the header of classic format files without the library
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __WIN32__
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "RNetCDF.h"
+
+
+/* The header of a classic, 64-bit offset or CDF5 file is described in
+   the NetCDF Users Guide ("File Format Specifications"). All numbers are
+   big-endian. Lengths and counts have 4 bytes, except in CDF5 files,
+   where they have 8 bytes. Names and values are padded to 4-byte boundaries.
+ */
+#define RNC_HDR_DIMENSION 10
+#define RNC_HDR_VARIABLE 11
+#define RNC_HDR_ATTRIBUTE 12
+
+/* Initial number of bytes read from a file, which is doubled as needed */
+#define RNC_HDR_READ 65536
+
+/* Status of parsing */
+enum { RNC_HDR_OK, RNC_HDR_MORE, RNC_HDR_INVALID };
+
+typedef struct {
+  const unsigned char *buf;
+  size_t len, pos;
+  double size;
+  int version, status;
+} R_nc_hdr;
+
+static const char *R_nc_hdr_types[] = {NULL, "NC_BYTE", "NC_CHAR",
+  "NC_SHORT", "NC_INT", "NC_FLOAT", "NC_DOUBLE", "NC_UBYTE", "NC_USHORT",
+  "NC_UINT", "NC_INT64", "NC_UINT64"};
+
+static const int R_nc_hdr_sizes[] = {0, 1, 1, 2, 4, 4, 8, 1, 2, 4, 8, 8};
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Decoding of header fields
+\*-----------------------------------------------------------------------------*/
+
+/* Return a pointer to the next n bytes of the header and advance past them,
+   or NULL if the bytes have not been read (setting status accordingly).
+ */
+static const unsigned char *
+R_nc_hdr_bytes (R_nc_hdr *hdr, size_t n)
+{
+  const unsigned char *ptr;
+  if (hdr->status != RNC_HDR_OK) {
+    return NULL;
+  }
+  if (n > hdr->len - hdr->pos) {
+    hdr->status = RNC_HDR_MORE;
+    return NULL;
+  }
+  ptr = hdr->buf + hdr->pos;
+  hdr->pos += n;
+  return ptr;
+}
+
+
+/* Decode an unsigned big-endian integer of n bytes */
+static double
+R_nc_hdr_uint (R_nc_hdr *hdr, size_t n)
+{
+  const unsigned char *ptr;
+  double result=0;
+  size_t ii;
+  ptr = R_nc_hdr_bytes (hdr, n);
+  if (!ptr) {
+    return 0;
+  }
+  for (ii=0; ii<n; ii++) {
+    result = result * 256 + ptr[ii];
+  }
+  return result;
+}
+
+
+/* Decode a count, which has 8 bytes in CDF5 files or 4 bytes otherwise */
+static double
+R_nc_hdr_count (R_nc_hdr *hdr)
+{
+  return R_nc_hdr_uint (hdr, (hdr->version == 5) ? 8 : 4);
+}
+
+
+/* Check that nelem items of at least size bytes fit in the rest of the file,
+   so that a corrupt count is not used for allocation or reading.
+   Returns 1 if the items fit, otherwise 0 (setting status if it was OK).
+ */
+static int
+R_nc_hdr_fits (R_nc_hdr *hdr, double nelem, size_t size)
+{
+  if (hdr->status != RNC_HDR_OK) {
+    return 0;
+  }
+  if (nelem * size > hdr->size - hdr->pos) {
+    hdr->status = RNC_HDR_INVALID;
+    return 0;
+  }
+  return 1;
+}
+
+
+/* Decode a name as a character string, or R_NilValue if it is incomplete */
+static SEXP
+R_nc_hdr_name (R_nc_hdr *hdr)
+{
+  const unsigned char *ptr;
+  double len;
+  len = R_nc_hdr_count (hdr);
+  if (hdr->status == RNC_HDR_OK && len > NC_MAX_NAME) {
+    hdr->status = RNC_HDR_INVALID;
+  }
+  if (!R_nc_hdr_fits (hdr, len, 1)) {
+    return R_NilValue;
+  }
+  ptr = R_nc_hdr_bytes (hdr, ((size_t) len + 3) & ~((size_t) 3));
+  if (!ptr) {
+    return R_NilValue;
+  }
+  return ScalarString (mkCharLenCE ((const char *) ptr, len, CE_UTF8));
+}
+
+
+/* Decode an array of nelem values with type xtype.
+   Text is converted to a character string with trailing nulls removed,
+   and numbers are converted to double precision.
+ */
+static SEXP
+R_nc_hdr_values (R_nc_hdr *hdr, int xtype, size_t nelem)
+{
+  const unsigned char *ptr;
+  size_t ii, jj, size, nbyte;
+  double *out;
+  uint64_t bits;
+  union { uint64_t u; double d; } d64;
+  union { uint32_t u; float f; } f32;
+  SEXP result;
+
+  size = R_nc_hdr_sizes[xtype];
+  nbyte = (nelem * size + 3) & ~((size_t) 3);
+  ptr = R_nc_hdr_bytes (hdr, nbyte);
+  if (!ptr) {
+    return R_NilValue;
+  }
+
+  if (xtype == NC_CHAR) {
+    while (nelem > 0 && ptr[nelem-1] == '\0') {
+      nelem--;
+    }
+    return ScalarString (mkCharLenCE ((const char *) ptr, nelem, CE_UTF8));
+  }
+
+  result = allocVector (REALSXP, nelem);
+  out = REAL (result);
+  for (ii=0; ii<nelem; ii++, ptr+=size) {
+    bits = 0;
+    for (jj=0; jj<size; jj++) {
+      bits = (bits << 8) | ptr[jj];
+    }
+    switch (xtype) {
+    case NC_BYTE:
+      out[ii] = (signed char) bits;
+      break;
+    case NC_SHORT:
+      out[ii] = (int16_t) bits;
+      break;
+    case NC_INT:
+      out[ii] = (int32_t) bits;
+      break;
+    case NC_FLOAT:
+      f32.u = bits;
+      out[ii] = f32.f;
+      break;
+    case NC_DOUBLE:
+      d64.u = bits;
+      out[ii] = d64.d;
+      break;
+    case NC_INT64:
+      out[ii] = (int64_t) bits;
+      break;
+    default:
+      out[ii] = bits;
+    }
+  }
+  return result;
+}
+
+
+/* Create a list with names, and store it as element i of list parent.
+   Objects are protected by their parents rather than R_nc_protect,
+   because a header may contain many thousands of objects.
+ */
+static SEXP
+R_nc_hdr_list (SEXP parent, R_xlen_t i, int n, const char **names)
+{
+  SEXP result, rnames;
+  int ii;
+  result = allocVector (VECSXP, n);
+  SET_VECTOR_ELT (parent, i, result);
+  rnames = allocVector (STRSXP, n);
+  setAttrib (result, R_NamesSymbol, rnames);
+  for (ii=0; ii<n; ii++) {
+    SET_STRING_ELT (rnames, ii, mkChar (names[ii]));
+  }
+  return result;
+}
+
+
+/* Decode the tag and number of elements of a list.
+   Returns the number of elements, setting status if the tag is invalid.
+ */
+static double
+R_nc_hdr_tag (R_nc_hdr *hdr, int tag)
+{
+  double hdrtag, nelem;
+  hdrtag = R_nc_hdr_uint (hdr, 4);
+  nelem = R_nc_hdr_count (hdr);
+  if (hdr->status == RNC_HDR_OK &&
+      !((hdrtag == tag) || (hdrtag == 0 && nelem == 0))) {
+    hdr->status = RNC_HDR_INVALID;
+  }
+  return nelem;
+}
+
+
+/* Decode a list of attributes as a list of the components returned by
+   att.inq.nc, with an additional component for the value.
+   The result is stored as element i of list parent.
+ */
+static void
+R_nc_hdr_atts (R_nc_hdr *hdr, SEXP parent, R_xlen_t i)
+{
+  static const char *names[] = {"id", "name", "type", "length", "value"};
+  double natt, nelem;
+  int iatt, xtype;
+  SEXP result, att;
+
+  natt = R_nc_hdr_tag (hdr, RNC_HDR_ATTRIBUTE);
+  /* Each attribute has at least a name, type and length */
+  if (!R_nc_hdr_fits (hdr, natt, 12)) {
+    return;
+  }
+  result = allocVector (VECSXP, natt);
+  SET_VECTOR_ELT (parent, i, result);
+  for (iatt=0; iatt<natt; iatt++) {
+    att = R_nc_hdr_list (result, iatt, 5, names);
+    SET_VECTOR_ELT (att, 0, ScalarInteger (iatt));
+    SET_VECTOR_ELT (att, 1, R_nc_hdr_name (hdr));
+    xtype = R_nc_hdr_uint (hdr, 4);
+    nelem = R_nc_hdr_count (hdr);
+    if (hdr->status != RNC_HDR_OK) {
+      return;
+    }
+    if (xtype < NC_BYTE || xtype > NC_UINT64 ||
+        (xtype > NC_DOUBLE && hdr->version != 5)) {
+      hdr->status = RNC_HDR_INVALID;
+      return;
+    }
+    if (!R_nc_hdr_fits (hdr, nelem, R_nc_hdr_sizes[xtype])) {
+      return;
+    }
+    SET_VECTOR_ELT (att, 2, mkString (R_nc_hdr_types[xtype]));
+    SET_VECTOR_ELT (att, 3, ScalarReal (nelem));
+    SET_VECTOR_ELT (att, 4, R_nc_hdr_values (hdr, xtype, nelem));
+  }
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Parsing of the header
+\*-----------------------------------------------------------------------------*/
+
+/* Parse the header in buf, setting hdr->status to RNC_HDR_MORE
+   if the header extends beyond the bytes in buf.
+ */
+static SEXP
+R_nc_hdr_parse (R_nc_hdr *hdr)
+{
+  static const char *rnames[] = {"file", "dimensions", "variables",
+    "attributes"};
+  static const char *fnames[] = {"ndims", "nvars", "ngatts", "unlimdimid",
+    "format"};
+  static const char *dnames[] = {"id", "name", "length", "unlim"};
+  static const char *vnames[] = {"id", "name", "type", "ndims", "dimids",
+    "natts", "quantize", "nsd", "attributes"};
+  const unsigned char *magic;
+  double numrecs, ndim, nvar, len, vndim;
+  int idim, ivar, jdim, xtype, unlimdimid=NA_INTEGER, *dimids;
+  SEXP result, file, dims, vars, dim, var;
+
+  result = R_nc_protect (allocVector (VECSXP, 1));
+  result = R_nc_hdr_list (result, 0, 4, rnames);
+
+  /*-- Magic number and number of records -------------------------------------*/
+  magic = R_nc_hdr_bytes (hdr, 4);
+  if (!magic) {
+    return R_NilValue;
+  }
+  hdr->version = magic[3];
+  if (memcmp (magic, "CDF", 3) != 0 ||
+      (hdr->version != 1 && hdr->version != 2 && hdr->version != 5)) {
+    hdr->status = RNC_HDR_INVALID;
+    return R_NilValue;
+  }
+  numrecs = R_nc_hdr_count (hdr);
+
+  /*-- Dimensions -------------------------------------------------------------*/
+  ndim = R_nc_hdr_tag (hdr, RNC_HDR_DIMENSION);
+  /* Each dimension has at least a name and length */
+  if (!R_nc_hdr_fits (hdr, ndim, 8)) {
+    return R_NilValue;
+  }
+  dims = allocVector (VECSXP, ndim);
+  SET_VECTOR_ELT (result, 1, dims);
+  for (idim=0; idim<ndim; idim++) {
+    dim = R_nc_hdr_list (dims, idim, 4, dnames);
+    SET_VECTOR_ELT (dim, 0, ScalarInteger (idim));
+    SET_VECTOR_ELT (dim, 1, R_nc_hdr_name (hdr));
+    len = R_nc_hdr_count (hdr);
+    if (hdr->status != RNC_HDR_OK) {
+      return R_NilValue;
+    }
+    if (len == 0) {
+      unlimdimid = idim;
+      /* Number of records is indeterminate while a file is streamed */
+      len = (numrecs == 4294967295.0 && hdr->version != 5) ? NA_REAL : numrecs;
+    }
+    SET_VECTOR_ELT (dim, 2, ScalarReal (len));
+    SET_VECTOR_ELT (dim, 3, ScalarLogical (unlimdimid == idim));
+  }
+
+  /*-- Global attributes ------------------------------------------------------*/
+  R_nc_hdr_atts (hdr, result, 3);
+  if (hdr->status != RNC_HDR_OK) {
+    return R_NilValue;
+  }
+
+  /*-- Variables --------------------------------------------------------------*/
+  nvar = R_nc_hdr_tag (hdr, RNC_HDR_VARIABLE);
+  /* Each variable has at least a name, dimensions, attributes,
+     type, size and offset */
+  if (!R_nc_hdr_fits (hdr, nvar, 28)) {
+    return R_NilValue;
+  }
+  vars = allocVector (VECSXP, nvar);
+  SET_VECTOR_ELT (result, 2, vars);
+  for (ivar=0; ivar<nvar; ivar++) {
+    var = R_nc_hdr_list (vars, ivar, 9, vnames);
+    SET_VECTOR_ELT (var, 0, ScalarInteger (ivar));
+    SET_VECTOR_ELT (var, 1, R_nc_hdr_name (hdr));
+    vndim = R_nc_hdr_count (hdr);
+    if (hdr->status != RNC_HDR_OK) {
+      return R_NilValue;
+    }
+    if (vndim > NC_MAX_VAR_DIMS) {
+      hdr->status = RNC_HDR_INVALID;
+      return R_NilValue;
+    }
+    if (vndim > 0) {
+      SET_VECTOR_ELT (var, 4, allocVector (INTSXP, vndim));
+      dimids = INTEGER (VECTOR_ELT (var, 4));
+      /* Return dimension ids in reverse (Fortran) order */
+      for (jdim=vndim-1; jdim>=0; jdim--) {
+        len = R_nc_hdr_count (hdr);
+        if (len >= ndim) {
+          hdr->status = RNC_HDR_INVALID;
+        }
+        dimids[jdim] = len;
+      }
+    } else {
+      /* Return single NA for scalars */
+      SET_VECTOR_ELT (var, 4, ScalarInteger (NA_INTEGER));
+    }
+    R_nc_hdr_atts (hdr, var, 8);
+    xtype = R_nc_hdr_uint (hdr, 4);
+    /* Skip size and offset of data */
+    R_nc_hdr_count (hdr);
+    R_nc_hdr_uint (hdr, (hdr->version == 1) ? 4 : 8);
+    if (hdr->status != RNC_HDR_OK) {
+      return R_NilValue;
+    }
+    if (xtype < NC_BYTE || xtype > NC_UINT64 ||
+        (xtype > NC_DOUBLE && hdr->version != 5)) {
+      hdr->status = RNC_HDR_INVALID;
+      return R_NilValue;
+    }
+    SET_VECTOR_ELT (var, 2, mkString (R_nc_hdr_types[xtype]));
+    SET_VECTOR_ELT (var, 3, ScalarInteger (vndim));
+    SET_VECTOR_ELT (var, 5, ScalarInteger (length (VECTOR_ELT (var, 8))));
+    SET_VECTOR_ELT (var, 6, ScalarString (NA_STRING));
+    SET_VECTOR_ELT (var, 7, ScalarInteger (NA_INTEGER));
+  }
+
+  /*-- Summary of the file ----------------------------------------------------*/
+  file = R_nc_hdr_list (result, 0, 5, fnames);
+  SET_VECTOR_ELT (file, 0, ScalarInteger (ndim));
+  SET_VECTOR_ELT (file, 1, ScalarInteger (nvar));
+  SET_VECTOR_ELT (file, 2, ScalarInteger (length (VECTOR_ELT (result, 3))));
+  SET_VECTOR_ELT (file, 3, ScalarInteger (unlimdimid));
+  SET_VECTOR_ELT (file, 4, mkString ((hdr->version == 1) ? "classic" :
+                                     (hdr->version == 2) ? "offset64" :
+                                     "cdf5"));
+  return result;
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_scan_header()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_scan_header (SEXP filename)
+{
+  const char *filep;
+  unsigned char *buf=NULL, *newbuf;
+  size_t alloc=0;
+  ssize_t nread;
+  int fd, eof=0;
+  struct stat info;
+  R_nc_hdr hdr;
+  SEXP result=R_NilValue;
+
+  filep = R_ExpandFileName (R_nc_strarg (filename));
+  fd = open (filep, O_RDONLY
+#ifdef O_BINARY
+                    | O_BINARY
+#endif
+             );
+  if (fd < 0) {
+    RERROR ("Cannot open file");
+  }
+  if (fstat (fd, &info) != 0) {
+    close (fd);
+    RERROR ("Cannot find size of file");
+  }
+
+  /* Read the start of the file, then read more and parse again
+     in the rare case that the header is larger.
+     Counts in the header are checked against the size of the file,
+     so the buffer never grows beyond the file. */
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.size = info.st_size;
+  hdr.status = RNC_HDR_MORE;
+  while (hdr.status == RNC_HDR_MORE && !eof) {
+    alloc = (alloc > 0) ? 2 * alloc : RNC_HDR_READ;
+    if (alloc > hdr.size && hdr.size > hdr.len) {
+      alloc = hdr.size;
+    }
+    newbuf = (unsigned char *) R_alloc (alloc, 1);
+    if (hdr.len > 0) {
+      memcpy (newbuf, buf, hdr.len);
+    }
+    buf = newbuf;
+    while (hdr.len < alloc) {
+#ifdef __WIN32__
+      nread = read (fd, buf + hdr.len, alloc - hdr.len);
+#else
+      nread = pread (fd, buf + hdr.len, alloc - hdr.len, hdr.len);
+#endif
+      if (nread <= 0) {
+        eof = 1;
+        break;
+      }
+      hdr.len += nread;
+    }
+    hdr.buf = buf;
+    hdr.pos = 0;
+    hdr.status = RNC_HDR_OK;
+    result = R_nc_hdr_parse (&hdr);
+  }
+  close (fd);
+
+  if (hdr.status == RNC_HDR_MORE) {
+    RERROR ("Header of file is truncated");
+  } else if (hdr.status != RNC_HDR_OK) {
+    RERROR ("File is not in classic, offset64 or cdf5 format");
+  }
+  RRETURN(result);
+}
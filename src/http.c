@@ -0,0 +1,601 @@
+/*=============================================================================*\
+ *
+ *  Name:       http.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Block cache for datasets accessed by HTTP byte ranges
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <utime.h>
+
+#ifdef HAVE_LIBCURL
+# include <curl/curl.h>
+#endif
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+#ifdef HAVE_NETCDF_MEM_H
+# include <netcdf_mem.h>
+#endif
+
+#include "common.h"
+#include "RNetCDF.h"
+
+
+/* Settings and counters of the block cache.
+   Remote datasets are divided into blocks of blocksize bytes,
+   which are kept in memory (up to memory bytes in total) and
+   in files of directory dir (up to disk bytes in total).
+   The least recently used blocks are discarded when a limit is exceeded.
+   The cache is disabled if both limits are zero.
+ */
+static struct {
+  double memory, disk;
+  size_t blocksize;
+  char *dir;
+  double mem_hits, disk_hits, misses, requests, fetch_bytes;
+} R_nc_http = {0, 0, 1048576, NULL, 0, 0, 0, 0, 0};
+
+
+#ifdef HAVE_LIBCURL
+
+/* Blocks held in memory, in order of use (most recent first).
+   A linear search is adequate, because each open touches each block once,
+   and the cost of a search is small compared to a transfer.
+ */
+typedef struct R_nc_block {
+  char *key;
+  unsigned char *data;
+  size_t size;
+  struct R_nc_block *prev, *next;
+} R_nc_block;
+
+static R_nc_block *R_nc_block_head=NULL, *R_nc_block_tail=NULL;
+static double R_nc_block_bytes=0;
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Memory cache
+\*-----------------------------------------------------------------------------*/
+
+static void
+R_nc_block_unlink (R_nc_block *block)
+{
+  if (block->prev) {
+    block->prev->next = block->next;
+  } else {
+    R_nc_block_head = block->next;
+  }
+  if (block->next) {
+    block->next->prev = block->prev;
+  } else {
+    R_nc_block_tail = block->prev;
+  }
+  block->prev = NULL;
+  block->next = NULL;
+}
+
+
+static void
+R_nc_block_push (R_nc_block *block)
+{
+  block->prev = NULL;
+  block->next = R_nc_block_head;
+  if (R_nc_block_head) {
+    R_nc_block_head->prev = block;
+  } else {
+    R_nc_block_tail = block;
+  }
+  R_nc_block_head = block;
+}
+
+
+static void
+R_nc_block_free (R_nc_block *block)
+{
+  R_nc_block_unlink (block);
+  R_nc_block_bytes -= block->size;
+  free (block->key);
+  free (block->data);
+  free (block);
+}
+
+
+/* Discard least recently used blocks until the memory limit is met */
+static void
+R_nc_block_trim (void)
+{
+  while (R_nc_block_tail && R_nc_block_bytes > R_nc_http.memory) {
+    R_nc_block_free (R_nc_block_tail);
+  }
+}
+
+
+/* Find a block in memory, marking it as most recently used */
+static R_nc_block *
+R_nc_block_find (const char *key)
+{
+  R_nc_block *block;
+  for (block=R_nc_block_head; block; block=block->next) {
+    if (strcmp (block->key, key) == 0) {
+      R_nc_block_unlink (block);
+      R_nc_block_push (block);
+      return block;
+    }
+  }
+  return NULL;
+}
+
+
+/* Store a copy of a block in memory (if it fits) */
+static void
+R_nc_block_store (const char *key, const unsigned char *data, size_t size)
+{
+  R_nc_block *block;
+  if (size > R_nc_http.memory) {
+    return;
+  }
+  block = calloc (1, sizeof (R_nc_block));
+  if (!block) {
+    return;
+  }
+  block->key = strdup (key);
+  block->data = malloc (size);
+  if (!block->key || !block->data) {
+    free (block->key);
+    free (block->data);
+    free (block);
+    return;
+  }
+  memcpy (block->data, data, size);
+  block->size = size;
+  R_nc_block_push (block);
+  R_nc_block_bytes += size;
+  R_nc_block_trim ();
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Disk cache
+\*-----------------------------------------------------------------------------*/
+
+/* Name of the file of a block in the disk cache, using a 64-bit FNV-1a hash
+   of the block key. Result is allocated by R_nc_alloc.
+ */
+static char *
+R_nc_disk_path (const char *key)
+{
+  char *path;
+  size_t len;
+
+  len = strlen (R_nc_http.dir) + 32;
+  path = R_nc_alloc (len, 1);
+  snprintf (path, len, "%s/%016llx.blk", R_nc_http.dir,
+            R_nc_hash (0, key, strlen (key)));
+  return path;
+}
+
+
+/* Read a block from the disk cache, marking it as recently used.
+   Returns 1 if the block was found with the expected size, 0 otherwise.
+ */
+static int
+R_nc_disk_find (const char *key, unsigned char *data, size_t size)
+{
+  FILE *file;
+  char *path;
+  int found=0;
+
+  if (R_nc_http.disk <= 0 || !R_nc_http.dir) {
+    return 0;
+  }
+  path = R_nc_disk_path (key);
+  file = fopen (path, "rb");
+  if (file) {
+    found = (fread (data, 1, size, file) == size && fgetc (file) == EOF);
+    fclose (file);
+  }
+  if (found) {
+    utime (path, NULL);
+  }
+  return found;
+}
+
+
+static void
+R_nc_disk_store (const char *key, const unsigned char *data, size_t size)
+{
+  FILE *file;
+  char *path;
+
+  if (R_nc_http.disk <= 0 || !R_nc_http.dir || size > R_nc_http.disk) {
+    return;
+  }
+  path = R_nc_disk_path (key);
+  file = fopen (path, "wb");
+  if (file) {
+    if (fwrite (data, 1, size, file) != size) {
+      fclose (file);
+      remove (path);
+    } else {
+      fclose (file);
+    }
+  }
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  HTTP transfers
+\*-----------------------------------------------------------------------------*/
+
+/* Growing buffer for the body of a response */
+typedef struct {
+  unsigned char *data;
+  size_t size, alloc;
+} R_nc_http_buf;
+
+
+static size_t
+R_nc_http_write (char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  R_nc_http_buf *buf = userdata;
+  size_t nbytes = size * nmemb, nalloc;
+  unsigned char *data;
+
+  if (buf->size + nbytes > buf->alloc) {
+    nalloc = 2 * (buf->size + nbytes);
+    data = realloc (buf->data, nalloc);
+    if (!data) {
+      return 0;
+    }
+    buf->data = data;
+    buf->alloc = nalloc;
+  }
+  memcpy (buf->data + buf->size, ptr, nbytes);
+  buf->size += nbytes;
+  return nbytes;
+}
+
+
+/* Collect response headers that identify the version of a remote file */
+static size_t
+R_nc_http_header (char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  R_nc_http_buf *buf = userdata;
+  size_t nbytes = size * nmemb;
+
+  if ((nbytes > 5 && strncasecmp (ptr, "ETag:", 5) == 0) ||
+      (nbytes > 14 && strncasecmp (ptr, "Last-Modified:", 14) == 0)) {
+    if (R_nc_http_write (ptr, 1, nbytes, buf) != nbytes) {
+      return 0;
+    }
+  }
+  return nbytes;
+}
+
+
+/* Perform a request for url, optionally limited to a byte range.
+   The body is appended to body (if not NULL), and identifying headers
+   are appended to head (if not NULL).
+   Returns the HTTP response code, or -1 if the transfer failed.
+ */
+static long
+R_nc_http_get (const char *url, const char *range, int nobody,
+               R_nc_http_buf *body, R_nc_http_buf *head, double *length)
+{
+  CURL *curl;
+  CURLcode status;
+  long code=-1;
+  curl_off_t clen;
+
+  curl = curl_easy_init ();
+  if (!curl) {
+    return -1;
+  }
+  curl_easy_setopt (curl, CURLOPT_URL, url);
+  curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt (curl, CURLOPT_FAILONERROR, 1L);
+  if (nobody) {
+    curl_easy_setopt (curl, CURLOPT_NOBODY, 1L);
+  }
+  if (range) {
+    curl_easy_setopt (curl, CURLOPT_RANGE, range);
+  }
+  if (body) {
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, R_nc_http_write);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, body);
+  }
+  if (head) {
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, R_nc_http_header);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, head);
+  }
+
+  status = curl_easy_perform (curl);
+  R_nc_http.requests++;
+  if (status == CURLE_OK) {
+    curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+    if (length) {
+      curl_easy_getinfo (curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &clen);
+      *length = clen;
+    }
+  }
+  curl_easy_cleanup (curl);
+  return code;
+}
+
+
+/* Fetch a remote dataset into memory, using cached blocks where possible.
+   Result is allocated by malloc, and its length is stored in size.
+   Result is NULL if the dataset is larger than both limits of the cache.
+ */
+static void *
+R_nc_http_load (const char *url, size_t *size)
+{
+  char *base, *prefix, *key, range[64];
+  const char *frag;
+  unsigned char *image, *data;
+  size_t nblock, iblock, jblock, offset, len, keylen;
+  double length;
+  long code;
+  int *cached;
+  R_nc_block *block;
+  R_nc_http_buf head={NULL, 0, 0}, body={NULL, 0, 0};
+
+  /*-- Find the size and version of the remote file ---------------------------*/
+  frag = strchr (url, '#');
+  len = frag ? (size_t) (frag - url) : strlen (url);
+  base = R_nc_alloc (len + 1, 1);
+  memcpy (base, url, len);
+  base[len] = '\0';
+
+  code = R_nc_http_get (base, NULL, 1, NULL, &head, &length);
+  if (code < 200 || code >= 300 || length < 0) {
+    free (head.data);
+    R_nc_error ("Cannot find size of remote dataset");
+  }
+  *size = length;
+  if (length > R_nc_http.memory &&
+      (!R_nc_http.dir || length > R_nc_http.disk)) {
+    free (head.data);
+    return NULL;
+  }
+
+  /* Blocks are identified by URL, size, ETag, Last-Modified and block size,
+     so that a changed file or setting is not read from stale blocks */
+  len = strlen (base) + head.size + 96;
+  prefix = R_nc_alloc (len, 1);
+  snprintf (prefix, len, "%s|%.0f|%.*s|%lu|", base, length,
+            (int) head.size, head.data ? (char *) head.data : "",
+            (unsigned long) R_nc_http.blocksize);
+  free (head.data);
+  keylen = strlen (prefix) + 24;
+  key = R_nc_alloc (keylen, 1);
+
+  /*-- Assemble the file from cached and fetched blocks -----------------------*/
+  image = malloc (*size > 0 ? *size : 1);
+  if (!image) {
+    R_nc_error ("Not enough memory for remote dataset");
+  }
+  nblock = (*size + R_nc_http.blocksize - 1) / R_nc_http.blocksize;
+  cached = (int *) R_nc_alloc (nblock, sizeof (int));
+
+  for (iblock=0; iblock<nblock; iblock++) {
+    offset = iblock * R_nc_http.blocksize;
+    len = *size - offset < R_nc_http.blocksize ? *size - offset
+                                                : R_nc_http.blocksize;
+    snprintf (key, keylen, "%s%lu", prefix, (unsigned long) iblock);
+    cached[iblock] = 1;
+    if ((block = R_nc_block_find (key)) && block->size == len) {
+      memcpy (image + offset, block->data, len);
+      R_nc_http.mem_hits++;
+    } else if (R_nc_disk_find (key, image + offset, len)) {
+      R_nc_block_store (key, image + offset, len);
+      R_nc_http.disk_hits++;
+    } else {
+      cached[iblock] = 0;
+      R_nc_http.misses++;
+    }
+  }
+
+  /* Fetch each run of missing blocks in a single range request */
+  for (iblock=0; iblock<nblock; iblock=jblock) {
+    if (cached[iblock]) {
+      jblock = iblock + 1;
+      continue;
+    }
+    for (jblock=iblock+1; jblock<nblock && !cached[jblock]; jblock++);
+    offset = iblock * R_nc_http.blocksize;
+    len = (jblock * R_nc_http.blocksize < *size ? jblock * R_nc_http.blocksize
+                                                 : *size) - offset;
+    snprintf (range, sizeof (range), "%lu-%lu", (unsigned long) offset,
+              (unsigned long) (offset + len - 1));
+    body.size = 0;
+    code = R_nc_http_get (base, range, 0, &body, NULL, NULL);
+    if (code == 206 && body.size == len) {
+      data = body.data;
+    } else if (code == 200 && body.size == *size) {
+      /* Server ignored the range and sent the whole file */
+      data = body.data + offset;
+    } else {
+      free (body.data);
+      free (image);
+      R_nc_error ("Cannot read byte range of remote dataset");
+      return NULL;
+    }
+    memcpy (image + offset, data, len);
+    R_nc_http.fetch_bytes += body.size;
+
+    for (; iblock<jblock; iblock++) {
+      offset = iblock * R_nc_http.blocksize;
+      len = *size - offset < R_nc_http.blocksize ? *size - offset
+                                                  : R_nc_http.blocksize;
+      snprintf (key, keylen, "%s%lu", prefix, (unsigned long) iblock);
+      R_nc_block_store (key, image + offset, len);
+      R_nc_disk_store (key, image + offset, len);
+    }
+  }
+  free (body.data);
+  if (R_nc_http.dir) {
+    R_nc_dir_trim (R_nc_http.dir, ".blk", R_nc_http.disk);
+  }
+
+  return image;
+}
+
+#endif /* HAVE_LIBCURL */
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Remote datasets
+\*-----------------------------------------------------------------------------*/
+
+int
+R_nc_http_cached (const char *url)
+{
+  const char *frag;
+  if (R_nc_http.memory <= 0 && R_nc_http.disk <= 0) {
+    return 0;
+  }
+  frag = strchr (url, '#');
+  return ((strncmp (url, "http://", 7) == 0 ||
+           strncmp (url, "https://", 8) == 0) &&
+          frag && strstr (frag, "bytes"));
+}
+
+
+int
+R_nc_http_open (const char *url, int omode, int *ncid, void **image)
+{
+#if defined HAVE_LIBCURL && defined HAVE_NETCDF_MEM_H
+  size_t size;
+  int status;
+  char *name;
+  *image = R_nc_http_load (url, &size);
+  if (!*image) {
+    /* Datasets too large for memory are read in byte-range mode */
+    return nc_open (url, omode, ncid);
+  }
+  /* The URL is not passed to the library, which would open it directly */
+  name = R_nc_alloc (strlen (url) + 1, 1);
+  strcpy (name, strrchr (url, '/') + 1);
+  name[strcspn (name, "#?")] = '\0';
+  status = nc_open_mem (name, omode, size, *image, ncid);
+  if (status != NC_NOERR) {
+    free (*image);
+    *image = NULL;
+  }
+  return status;
+#elif defined HAVE_LIBCURL
+  R_nc_error ("RNetCDF was built without netcdf_mem.h, so remote datasets cannot be cached");
+  return NC_NOERR;
+#else
+  R_nc_error ("RNetCDF was built without libcurl, so remote datasets cannot be cached");
+  return NC_NOERR;
+#endif
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_http_cache()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_http_cache (SEXP memory, SEXP disk, SEXP dir, SEXP blocksize, SEXP reset)
+{
+  double dval;
+  const char *dirp;
+  SEXP result;
+
+  /*-- Change settings that are not NA ----------------------------------------*/
+  dval = asReal (memory);
+  if (!ISNA (dval)) {
+    R_nc_http.memory = (dval > 0) ? dval * 1048576 : 0;
+  }
+  dval = asReal (disk);
+  if (!ISNA (dval)) {
+    R_nc_http.disk = (dval > 0) ? dval * 1048576 : 0;
+  }
+  if (isString (dir) && STRING_ELT (dir, 0) != NA_STRING) {
+    dirp = R_ExpandFileName (R_nc_strarg (dir));
+    free (R_nc_http.dir);
+    R_nc_http.dir = strdup (dirp);
+  }
+  dval = asReal (blocksize);
+  if (!ISNA (dval)) {
+    if (dval < 1) {
+      RERROR ("Block size must be positive");
+    }
+    R_nc_http.blocksize = dval;
+  }
+  if (R_nc_http.disk > 0 && !R_nc_http.dir) {
+    RERROR ("Directory of disk cache must be specified");
+  }
+
+#ifdef HAVE_LIBCURL
+  R_nc_block_trim ();
+  if (R_nc_http.dir) {
+    R_nc_dir_trim (R_nc_http.dir, ".blk", R_nc_http.disk);
+  }
+#else
+  if (R_nc_http.memory > 0 || R_nc_http.disk > 0) {
+    R_nc_http.memory = 0;
+    R_nc_http.disk = 0;
+    RERROR ("RNetCDF was built without libcurl, so remote datasets cannot be cached");
+  }
+#endif
+
+  /*-- Returning the list -----------------------------------------------------*/
+  result = R_nc_protect (allocVector (VECSXP, 9));
+  SET_VECTOR_ELT (result, 0, ScalarReal (R_nc_http.memory / 1048576));
+  SET_VECTOR_ELT (result, 1, ScalarReal (R_nc_http.disk / 1048576));
+  SET_VECTOR_ELT (result, 2, R_nc_http.dir ? mkString (R_nc_http.dir)
+                                           : ScalarString (NA_STRING));
+  SET_VECTOR_ELT (result, 3, ScalarReal (R_nc_http.blocksize));
+  SET_VECTOR_ELT (result, 4, ScalarReal (R_nc_http.mem_hits));
+  SET_VECTOR_ELT (result, 5, ScalarReal (R_nc_http.disk_hits));
+  SET_VECTOR_ELT (result, 6, ScalarReal (R_nc_http.misses));
+  SET_VECTOR_ELT (result, 7, ScalarReal (R_nc_http.requests));
+  SET_VECTOR_ELT (result, 8, ScalarReal (R_nc_http.fetch_bytes));
+
+  /*-- Reset the counters (if requested) --------------------------------------*/
+  if (asLogical (reset) == TRUE) {
+    R_nc_http.mem_hits = 0;
+    R_nc_http.disk_hits = 0;
+    R_nc_http.misses = 0;
+    R_nc_http.requests = 0;
+    R_nc_http.fetch_bytes = 0;
+  }
+
+  RRETURN(result);
+}
@@ -32,47 +32,159 @@
 
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
+#include <netcdf.h>
+#include "common.h"
 #include "RNetCDF.h"
 
+/* Wrap native routines so that each call is recorded as a span
+   when timeline tracing is enabled.
+   The count of memory in use is reset on entry, in case a previous call
+   was interrupted by an error from R before it could be reset on exit.
+ */
+#define RNC_TRACED(FUN, PARAMS, ARGS) \
+static SEXP FUN##_traced PARAMS { \
+  int span; \
+  SEXP result; \
+  R_nc_alloc_used = 0; \
+  span = R_nc_trace_begin (#FUN, RNC_TRACE_CALL); \
+  result = FUN ARGS; \
+  R_nc_trace_end (span); \
+  return result; \
+}
+
+#define P0 (void)
+#define P1 (SEXP a1)
+#define P2 (SEXP a1, SEXP a2)
+#define P3 (SEXP a1, SEXP a2, SEXP a3)
+#define P4 (SEXP a1, SEXP a2, SEXP a3, SEXP a4)
+#define P5 (SEXP a1, SEXP a2, SEXP a3, SEXP a4, SEXP a5)
+#define P6 (SEXP a1, SEXP a2, SEXP a3, SEXP a4, SEXP a5, SEXP a6)
+#define P7 (SEXP a1, SEXP a2, SEXP a3, SEXP a4, SEXP a5, SEXP a6, SEXP a7)
+#define P8 (SEXP a1, SEXP a2, SEXP a3, SEXP a4, SEXP a5, SEXP a6, SEXP a7, \
+            SEXP a8)
+#define P9 (SEXP a1, SEXP a2, SEXP a3, SEXP a4, SEXP a5, SEXP a6, SEXP a7, \
+            SEXP a8, SEXP a9)
+
+#define A0 ()
+#define A1 (a1)
+#define A2 (a1, a2)
+#define A3 (a1, a2, a3)
+#define A4 (a1, a2, a3, a4)
+#define A5 (a1, a2, a3, a4, a5)
+#define A6 (a1, a2, a3, a4, a5, a6)
+#define A7 (a1, a2, a3, a4, a5, a6, a7)
+#define A8 (a1, a2, a3, a4, a5, a6, a7, a8)
+#define A9 (a1, a2, a3, a4, a5, a6, a7, a8, a9)
+
+RNC_TRACED(R_nc_copy_att, P5, A5)
+RNC_TRACED(R_nc_delete_att, P3, A3)
+RNC_TRACED(R_nc_get_att, P5, A5)
+RNC_TRACED(R_nc_inq_att, P3, A3)
+RNC_TRACED(R_nc_put_att, P5, A5)
+RNC_TRACED(R_nc_rename_att, P4, A4)
+RNC_TRACED(R_nc_close, P1, A1)
+RNC_TRACED(R_nc_copy_file, P6, A6)
+RNC_TRACED(R_nc_copy_schema, P5, A5)
+RNC_TRACED(R_nc_create, P5, A5)
+RNC_TRACED(R_nc_inq_file, P1, A1)
+RNC_TRACED(R_nc_open, P6, A6)
+RNC_TRACED(R_nc_refresh, P1, A1)
+RNC_TRACED(R_nc_scan_header, P1, A1)
+RNC_TRACED(R_nc_sync, P1, A1)
+RNC_TRACED(R_nc_def_dim, P4, A4)
+RNC_TRACED(R_nc_inq_dim, P2, A2)
+RNC_TRACED(R_nc_inq_unlimids, P1, A1)
+RNC_TRACED(R_nc_rename_dim, P3, A3)
+RNC_TRACED(R_nc_def_grp, P2, A2)
+RNC_TRACED(R_nc_inq_grp_parent, P1, A1)
+RNC_TRACED(R_nc_inq_natts, P1, A1)
+RNC_TRACED(R_nc_inq_grpname, P2, A2)
+RNC_TRACED(R_nc_inq_grp_ncid, P3, A3)
+RNC_TRACED(R_nc_inq_grps, P1, A1)
+RNC_TRACED(R_nc_inq_typeids, P1, A1)
+RNC_TRACED(R_nc_inq_varids, P1, A1)
+RNC_TRACED(R_nc_inq_dimids, P2, A2)
+RNC_TRACED(R_nc_rename_grp, P2, A2)
+RNC_TRACED(R_nc_def_type, P9, A9)
+RNC_TRACED(R_nc_inq_type, P3, A3)
+RNC_TRACED(R_nc_calendar, P2, A2)
+RNC_TRACED(R_nc_utinit, P1, A1)
+RNC_TRACED(R_nc_inv_calendar, P2, A2)
+RNC_TRACED(R_nc_utterm, P0, A0)
+RNC_TRACED(R_nc_chunk_advise, P5, A5)
+RNC_TRACED(R_nc_copy_var, P9, A9)
+RNC_TRACED(R_nc_def_var, P9, A9)
+RNC_TRACED(R_nc_get_var, P8, A8)
+RNC_TRACED(R_nc_get_arrow, P5, A5)
+RNC_TRACED(R_nc_get_ragged, P9, A9)
+RNC_TRACED(R_nc_get_rec, P9, A9)
+RNC_TRACED(R_nc_get_sparse, P7, A7)
+RNC_TRACED(R_nc_get_table, P9, A9)
+RNC_TRACED(R_nc_get_vlen_flat, P7, A7)
+RNC_TRACED(R_nc_inq_var, P2, A2)
+RNC_TRACED(R_nc_put_var, P8, A8)
+RNC_TRACED(R_nc_put_vlen_flat, P8, A8)
+RNC_TRACED(R_nc_rename_var, P3, A3)
+
 /* Register native routines */
 
 static const R_CallMethodDef callMethods[]  = {
-  {"R_nc_copy_att", (DL_FUNC) &R_nc_copy_att, 5},
-  {"R_nc_delete_att", (DL_FUNC) &R_nc_delete_att, 3},
-  {"R_nc_get_att", (DL_FUNC) &R_nc_get_att, 5},
-  {"R_nc_inq_att", (DL_FUNC) &R_nc_inq_att, 3},
-  {"R_nc_put_att", (DL_FUNC) &R_nc_put_att, 5},
-  {"R_nc_rename_att", (DL_FUNC) &R_nc_rename_att, 4},
-  {"R_nc_close", (DL_FUNC) &R_nc_close, 1},
-  {"R_nc_create", (DL_FUNC) &R_nc_create, 5},
-  {"R_nc_inq_file", (DL_FUNC) &R_nc_inq_file, 1},
-  {"R_nc_open", (DL_FUNC) &R_nc_open, 4},
-  {"R_nc_sync", (DL_FUNC) &R_nc_sync, 1},
-  {"R_nc_def_dim", (DL_FUNC) &R_nc_def_dim, 4},
-  {"R_nc_inq_dim", (DL_FUNC) &R_nc_inq_dim, 2},
-  {"R_nc_inq_unlimids", (DL_FUNC) &R_nc_inq_unlimids, 1},
-  {"R_nc_rename_dim", (DL_FUNC) &R_nc_rename_dim, 3},
-  {"R_nc_def_grp", (DL_FUNC) &R_nc_def_grp, 2},
-  {"R_nc_inq_grp_parent", (DL_FUNC) &R_nc_inq_grp_parent, 1},
-  {"R_nc_inq_natts", (DL_FUNC) &R_nc_inq_natts, 1},
-  {"R_nc_inq_grpname", (DL_FUNC) &R_nc_inq_grpname, 2},
-  {"R_nc_inq_grp_ncid", (DL_FUNC) &R_nc_inq_grp_ncid, 3},
-  {"R_nc_inq_grps", (DL_FUNC) &R_nc_inq_grps, 1},
-  {"R_nc_inq_typeids", (DL_FUNC) &R_nc_inq_typeids, 1},
-  {"R_nc_inq_varids", (DL_FUNC) &R_nc_inq_varids, 1},
-  {"R_nc_inq_dimids", (DL_FUNC) &R_nc_inq_dimids, 2},
-  {"R_nc_rename_grp", (DL_FUNC) &R_nc_rename_grp, 2},
-  {"R_nc_def_type", (DL_FUNC) &R_nc_def_type, 9},
-  {"R_nc_inq_type", (DL_FUNC) &R_nc_inq_type, 3},
-  {"R_nc_calendar", (DL_FUNC) &R_nc_calendar, 2},
-  {"R_nc_utinit", (DL_FUNC) &R_nc_utinit, 1},
-  {"R_nc_inv_calendar", (DL_FUNC) &R_nc_inv_calendar, 2},
-  {"R_nc_utterm", (DL_FUNC) &R_nc_utterm, 0},
-  {"R_nc_def_var", (DL_FUNC) &R_nc_def_var, 4},
-  {"R_nc_get_var", (DL_FUNC) &R_nc_get_var, 8},
-  {"R_nc_inq_var", (DL_FUNC) &R_nc_inq_var, 2},
-  {"R_nc_put_var", (DL_FUNC) &R_nc_put_var, 7},
-  {"R_nc_rename_var", (DL_FUNC) &R_nc_rename_var, 3},
+  {"R_nc_api_check", (DL_FUNC) &R_nc_api_check, 1},
+  {"R_nc_copy_att", (DL_FUNC) &R_nc_copy_att_traced, 5},
+  {"R_nc_delete_att", (DL_FUNC) &R_nc_delete_att_traced, 3},
+  {"R_nc_get_att", (DL_FUNC) &R_nc_get_att_traced, 5},
+  {"R_nc_inq_att", (DL_FUNC) &R_nc_inq_att_traced, 3},
+  {"R_nc_put_att", (DL_FUNC) &R_nc_put_att_traced, 5},
+  {"R_nc_rename_att", (DL_FUNC) &R_nc_rename_att_traced, 4},
+  {"R_nc_bench_convert", (DL_FUNC) &R_nc_bench_convert, 8},
+  {"R_nc_close", (DL_FUNC) &R_nc_close_traced, 1},
+  {"R_nc_copy_file", (DL_FUNC) &R_nc_copy_file_traced, 6},
+  {"R_nc_copy_schema", (DL_FUNC) &R_nc_copy_schema_traced, 5},
+  {"R_nc_create", (DL_FUNC) &R_nc_create_traced, 5},
+  {"R_nc_http_cache", (DL_FUNC) &R_nc_http_cache, 5},
+  {"R_nc_inq_file", (DL_FUNC) &R_nc_inq_file_traced, 1},
+  {"R_nc_inq_stats", (DL_FUNC) &R_nc_inq_stats, 2},
+  {"R_nc_open", (DL_FUNC) &R_nc_open_traced, 6},
+  {"R_nc_refresh", (DL_FUNC) &R_nc_refresh_traced, 1},
+  {"R_nc_scan_header", (DL_FUNC) &R_nc_scan_header_traced, 1},
+  {"R_nc_sync", (DL_FUNC) &R_nc_sync_traced, 1},
+  {"R_nc_def_dim", (DL_FUNC) &R_nc_def_dim_traced, 4},
+  {"R_nc_inq_dim", (DL_FUNC) &R_nc_inq_dim_traced, 2},
+  {"R_nc_inq_unlimids", (DL_FUNC) &R_nc_inq_unlimids_traced, 1},
+  {"R_nc_rename_dim", (DL_FUNC) &R_nc_rename_dim_traced, 3},
+  {"R_nc_def_grp", (DL_FUNC) &R_nc_def_grp_traced, 2},
+  {"R_nc_inq_grp_parent", (DL_FUNC) &R_nc_inq_grp_parent_traced, 1},
+  {"R_nc_inq_natts", (DL_FUNC) &R_nc_inq_natts_traced, 1},
+  {"R_nc_inq_grpname", (DL_FUNC) &R_nc_inq_grpname_traced, 2},
+  {"R_nc_inq_grp_ncid", (DL_FUNC) &R_nc_inq_grp_ncid_traced, 3},
+  {"R_nc_inq_grps", (DL_FUNC) &R_nc_inq_grps_traced, 1},
+  {"R_nc_inq_typeids", (DL_FUNC) &R_nc_inq_typeids_traced, 1},
+  {"R_nc_inq_varids", (DL_FUNC) &R_nc_inq_varids_traced, 1},
+  {"R_nc_inq_dimids", (DL_FUNC) &R_nc_inq_dimids_traced, 2},
+  {"R_nc_rename_grp", (DL_FUNC) &R_nc_rename_grp_traced, 2},
+  {"R_nc_trace_start", (DL_FUNC) &R_nc_trace_start, 1},
+  {"R_nc_trace_stop", (DL_FUNC) &R_nc_trace_stop, 0},
+  {"R_nc_def_type", (DL_FUNC) &R_nc_def_type_traced, 9},
+  {"R_nc_inq_type", (DL_FUNC) &R_nc_inq_type_traced, 3},
+  {"R_nc_calendar", (DL_FUNC) &R_nc_calendar_traced, 2},
+  {"R_nc_utinit", (DL_FUNC) &R_nc_utinit_traced, 1},
+  {"R_nc_inv_calendar", (DL_FUNC) &R_nc_inv_calendar_traced, 2},
+  {"R_nc_utterm", (DL_FUNC) &R_nc_utterm_traced, 0},
+  {"R_nc_chunk_advise", (DL_FUNC) &R_nc_chunk_advise_traced, 5},
+  {"R_nc_copy_var", (DL_FUNC) &R_nc_copy_var_traced, 9},
+  {"R_nc_def_var", (DL_FUNC) &R_nc_def_var_traced, 9},
+  {"R_nc_get_var", (DL_FUNC) &R_nc_get_var_traced, 8},
+  {"R_nc_get_arrow", (DL_FUNC) &R_nc_get_arrow_traced, 5},
+  {"R_nc_get_ragged", (DL_FUNC) &R_nc_get_ragged_traced, 9},
+  {"R_nc_get_rec", (DL_FUNC) &R_nc_get_rec_traced, 9},
+  {"R_nc_get_sparse", (DL_FUNC) &R_nc_get_sparse_traced, 7},
+  {"R_nc_get_table", (DL_FUNC) &R_nc_get_table_traced, 9},
+  {"R_nc_get_vlen_flat", (DL_FUNC) &R_nc_get_vlen_flat_traced, 7},
+  {"R_nc_inq_var", (DL_FUNC) &R_nc_inq_var_traced, 2},
+  {"R_nc_put_var", (DL_FUNC) &R_nc_put_var_traced, 8},
+  {"R_nc_put_vlen_flat", (DL_FUNC) &R_nc_put_vlen_flat_traced, 8},
+  {"R_nc_rename_var", (DL_FUNC) &R_nc_rename_var_traced, 3},
+  {"R_nc_result_cache", (DL_FUNC) &R_nc_result_cache, 3},
   {NULL, NULL, 0}
 };
 
@@ -81,6 +193,7 @@ void R_init_RNetCDF(DllInfo *info)
    R_registerRoutines(info, NULL, callMethods, NULL, NULL);
    R_useDynamicSymbols(info, FALSE);
    R_forceSymbols(info, TRUE);
+   R_nc_api_init();
 }
 
 
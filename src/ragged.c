@@ -0,0 +1,407 @@
+/*=============================================================================*\
+ *
+ *  Name:       ragged.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Read features of CF discrete sampling geometry ragged arrays
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "convert.h"
+#include "RNetCDF.h"
+
+
+/* The CF conventions (chapter 9, "Discrete Sampling Geometries") describe
+   two ragged array representations of features with varying numbers of
+   samples. In a contiguous ragged array, the samples of each feature are
+   stored consecutively along the sample dimension, and a count variable
+   along the instance dimension (with attribute sample_dimension) gives the
+   number of samples in each feature. In an indexed ragged array, an index
+   variable along the sample dimension (with attribute instance_dimension)
+   gives the zero-based feature of each sample.
+ */
+
+
+/* Copy n elements of vector x, starting from element from,
+   to a new vector with the same type and attributes (except dimensions).
+   The result is protected by R_nc_protect.
+ */
+static SEXP
+R_nc_ragged_slice (SEXP x, R_xlen_t from, R_xlen_t n)
+{
+  SEXP y;
+  R_xlen_t ii;
+
+  y = R_nc_protect (allocVector (TYPEOF (x), n));
+  switch (TYPEOF (x)) {
+  case LGLSXP:
+    memcpy (LOGICAL (y), LOGICAL (x) + from, n * sizeof (int));
+    break;
+  case INTSXP:
+    memcpy (INTEGER (y), INTEGER (x) + from, n * sizeof (int));
+    break;
+  case REALSXP:
+    memcpy (REAL (y), REAL (x) + from, n * sizeof (double));
+    break;
+  case RAWSXP:
+    memcpy (RAW (y), RAW (x) + from, n);
+    break;
+  case STRSXP:
+    for (ii=0; ii<n; ii++) {
+      SET_STRING_ELT (y, ii, STRING_ELT (x, from + ii));
+    }
+    break;
+  case VECSXP:
+    for (ii=0; ii<n; ii++) {
+      SET_VECTOR_ELT (y, ii, VECTOR_ELT (x, from + ii));
+    }
+    break;
+  default:
+    RERROR ("Unsupported type of variable in ragged array");
+  }
+  copyMostAttrib (x, y);
+  return y;
+}
+
+
+/* Set the attributes of a list of columns with nrow rows,
+   so that it becomes a data.frame.
+ */
+static void
+R_nc_ragged_frame (SEXP list, SEXP names, R_xlen_t nrow)
+{
+  SEXP rownames;
+  if (nrow > INT_MAX) {
+    R_nc_error ("Too many rows for a data.frame");
+  }
+  setAttrib (list, R_NamesSymbol, names);
+  rownames = R_nc_protect (allocVector (INTSXP, 2));
+  INTEGER (rownames)[0] = NA_INTEGER;
+  INTEGER (rownames)[1] = -((int) nrow);
+  setAttrib (list, R_RowNamesSymbol, rownames);
+  setAttrib (list, R_ClassSymbol, mkString ("data.frame"));
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_get_ragged()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_get_ragged (SEXP nc, SEXP varids, SEXP ragged, SEXP instancedim,
+                 SEXP features, SEXP flat, SEXP fitnum, SEXP namode,
+                 SEXP unpack)
+{
+  int ncid, raggedid, raggeddim, instdim, sampledim, indexed, nvar, ivar,
+      varid, ndims, dimids[NC_MAX_VAR_DIMS], isfit, inamode, isunpack, span;
+  size_t ninst, nsample, nsel, isel, jsel, irow, jrow, total, nfill,
+         cstart[2], ccount[2], recsize, xsize;
+  long long *ragvals, *first, *fcount, *foffset, *sel, *filled, feature;
+  double *featp, add, scale, *addp, *scalep;
+  void *fillp, *minp, *maxp;
+  char *buf, *stage, varname[NC_MAX_NAME+1];
+  nc_type xtype;
+  R_nc_buf io;
+  R_nc_handle *handle;
+  R_nc_mark mark;
+  SEXP colnames, columns, result, offsets, counts, featids, frame, column;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+  nvar = length (varids);
+  isfit = (asLogical (fitnum) == TRUE);
+  inamode = asInteger (namode);
+  isunpack = (asLogical (unpack) == TRUE);
+
+  R_nc_check (R_nc_var_id (ragged, ncid, &raggedid));
+  R_nc_check (R_nc_dim_id (instancedim, ncid, &instdim, 0));
+  R_nc_check (nc_inq_dimlen (ncid, instdim, &ninst));
+
+  /* The count variable of a contiguous ragged array is along the
+     instance dimension, and the index variable of an indexed ragged array
+     is along the sample dimension */
+  R_nc_check (nc_inq_var (ncid, raggedid, NULL, NULL, &ndims, &raggeddim,
+                          NULL));
+  if (ndims != 1) {
+    RERROR ("Count or index variable of ragged array must have one dimension");
+  }
+  indexed = (raggeddim != instdim);
+
+  /*-- Read the count or index variable ---------------------------------------*/
+  span = R_nc_trace_begin ("nc_get_var_longlong", RNC_TRACE_IO);
+  if (indexed) {
+    sampledim = raggeddim;
+    R_nc_check (nc_inq_dimlen (ncid, sampledim, &nsample));
+    ragvals = (long long *) R_nc_alloc (nsample, sizeof (long long));
+    if (nsample > 0) {
+      R_nc_check (nc_get_var_longlong (ncid, raggedid, ragvals));
+    }
+  } else {
+    sampledim = -1;
+    nsample = 0;
+    ragvals = (long long *) R_nc_alloc (ninst, sizeof (long long));
+    if (ninst > 0) {
+      R_nc_check (nc_get_var_longlong (ncid, raggedid, ragvals));
+    }
+  }
+  R_nc_trace_end (span);
+
+  /*-- Find the samples of each feature in the file ---------------------------*/
+  first = (long long *) R_nc_alloc (ninst, sizeof (long long));
+  fcount = (long long *) R_nc_alloc (ninst, sizeof (long long));
+  for (isel=0; isel<ninst; isel++) {
+    first[isel] = 0;
+    fcount[isel] = 0;
+  }
+  if (indexed) {
+    /* Samples with an invalid index (e.g. a fill value) are ignored */
+    for (irow=0; irow<nsample; irow++) {
+      feature = ragvals[irow];
+      if (feature >= 0 && (size_t) feature < ninst) {
+        fcount[feature]++;
+      }
+    }
+  } else {
+    total = 0;
+    for (isel=0; isel<ninst; isel++) {
+      if (ragvals[isel] < 0) {
+        RERROR ("Negative count in contiguous ragged array");
+      }
+      first[isel] = total;
+      fcount[isel] = ragvals[isel];
+      total += ragvals[isel];
+    }
+  }
+
+  /*-- Find the selected features ---------------------------------------------*/
+  if (isNull (features)) {
+    nsel = ninst;
+  } else {
+    nsel = xlength (features);
+  }
+  featids = R_nc_protect (allocVector (INTSXP, nsel));
+  sel = (long long *) R_nc_alloc (ninst, sizeof (long long));
+  for (isel=0; isel<ninst; isel++) {
+    sel[isel] = -1;
+  }
+  if (!isNull (features)) {
+    features = R_nc_protect (coerceVector (features, REALSXP));
+    featp = REAL (features);
+  } else {
+    featp = NULL;
+  }
+  for (isel=0; isel<nsel; isel++) {
+    if (featp) {
+      if (!R_FINITE (featp[isel]) || featp[isel] < 1 || featp[isel] > ninst) {
+        RERROR ("Feature index out of range");
+      }
+      feature = featp[isel] - 1;
+    } else {
+      feature = isel;
+    }
+    if (sel[feature] >= 0) {
+      RERROR ("Features must not be repeated");
+    }
+    sel[feature] = isel;
+    INTEGER (featids)[isel] = feature + 1;
+  }
+
+  /* Samples of the selected features are stored consecutively in the result */
+  foffset = (long long *) R_nc_alloc (nsel, sizeof (long long));
+  total = 0;
+  for (isel=0; isel<nsel; isel++) {
+    feature = INTEGER (featids)[isel] - 1;
+    foffset[isel] = total;
+    total += fcount[feature];
+  }
+  filled = (long long *) R_nc_alloc (nsel, sizeof (long long));
+
+  /*-- Enter data mode (if necessary) -----------------------------------------*/
+  R_nc_check (R_nc_enddef (ncid));
+
+  /*-- Read the samples of selected features from each variable ---------------*/
+  colnames = R_nc_protect (allocVector (STRSXP, nvar));
+  columns = R_nc_protect (allocVector (VECSXP, nvar));
+  for (ivar=0; ivar<nvar; ivar++) {
+    R_nc_check (R_nc_var_id (VECTOR_ELT (varids, ivar), ncid, &varid));
+    R_nc_check (nc_inq_var (ncid, varid, varname, &xtype, &ndims, dimids,
+                            NULL));
+    if (sampledim < 0) {
+      sampledim = dimids[0];
+    }
+    if (ndims != (xtype == NC_CHAR ? 2 : 1) || dimids[0] != sampledim) {
+      RERROR ("Variables must be along the sample dimension of ragged array");
+    }
+    SET_STRING_ELT (colnames, ivar, mkChar (varname));
+
+    /* Sizes of samples in the file and in the result */
+    cstart[1] = 0;
+    ccount[1] = 1;
+    if (ndims > 1) {
+      R_nc_check (nc_inq_dimlen (ncid, dimids[1], &(ccount[1])));
+    }
+    R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+    recsize = xsize * ccount[1];
+
+    /* Get fill and packing attributes (if any) */
+    span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
+    fillp = NULL;
+    minp = NULL;
+    maxp = NULL;
+    R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
+    scalep = NULL;
+    addp = NULL;
+    if (isunpack) {
+      scalep = &scale;
+      addp = &add;
+      R_nc_pack_att (ncid, varid, &scalep, &addp);
+    }
+    R_nc_trace_end (span);
+
+    ccount[0] = total;
+    buf = R_nc_c2r_init (&io, NULL, ncid, xtype, ndims, ccount, 0, isfit,
+                         fillp, minp, maxp, scalep, addp);
+
+    span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
+    if (!indexed) {
+      /* Read runs of selected features that are adjacent in the file */
+      for (isel=0; isel<nsel; isel=jsel) {
+        feature = INTEGER (featids)[isel] - 1;
+        cstart[0] = first[feature];
+        ccount[0] = fcount[feature];
+        for (jsel=isel+1; jsel<nsel; jsel++) {
+          feature = INTEGER (featids)[jsel] - 1;
+          if ((size_t) first[feature] != cstart[0] + ccount[0]) {
+            break;
+          }
+          ccount[0] += fcount[feature];
+        }
+        if (ccount[0] > 0) {
+          R_nc_check (nc_get_vara (ncid, varid, cstart, ccount,
+                                   buf + foffset[isel] * recsize));
+        }
+      }
+    } else if (total > 0) {
+      /* Read runs of consecutive samples of selected features,
+         then move each sample to the samples of its feature */
+      stage = R_nc_alloc (total, recsize);
+      nfill = 0;
+      for (irow=0; irow<nsample; irow=jrow) {
+        for (jrow=irow; jrow<nsample; jrow++) {
+          feature = ragvals[jrow];
+          if (feature < 0 || (size_t) feature >= ninst || sel[feature] < 0) {
+            break;
+          }
+        }
+        if (jrow > irow) {
+          cstart[0] = irow;
+          ccount[0] = jrow - irow;
+          R_nc_check (nc_get_vara (ncid, varid, cstart, ccount,
+                                   stage + nfill * recsize));
+          nfill += ccount[0];
+        } else {
+          jrow++;
+        }
+      }
+      for (isel=0; isel<nsel; isel++) {
+        filled[isel] = 0;
+      }
+      nfill = 0;
+      for (irow=0; irow<nsample; irow++) {
+        feature = ragvals[irow];
+        if (feature >= 0 && (size_t) feature < ninst && sel[feature] >= 0) {
+          isel = sel[feature];
+          memcpy (buf + (foffset[isel] + filled[isel]) * recsize,
+                  stage + nfill * recsize, recsize);
+          filled[isel]++;
+          nfill++;
+        }
+      }
+    }
+    R_nc_trace_end (span);
+
+    span = R_nc_trace_begin ("R_nc_c2r", RNC_TRACE_CONVERT);
+    column = R_nc_c2r (&io);
+    setAttrib (column, R_DimSymbol, R_NilValue);
+    SET_VECTOR_ELT (columns, ivar, column);
+    R_nc_trace_end (span);
+
+    if (handle) {
+      handle->stats.get_calls++;
+      handle->stats.get_bytes += (double) total * recsize;
+    }
+  }
+
+  /*-- Construct the result ---------------------------------------------------*/
+  if (asLogical (flat) == TRUE) {
+    /* Samples of all features in one table, with the position of each
+       feature in the table */
+    R_nc_ragged_frame (columns, colnames, total);
+    offsets = R_nc_protect (allocVector (REALSXP, nsel));
+    counts = R_nc_protect (allocVector (REALSXP, nsel));
+    for (isel=0; isel<nsel; isel++) {
+      feature = INTEGER (featids)[isel] - 1;
+      REAL (offsets)[isel] = foffset[isel] + 1;
+      REAL (counts)[isel] = fcount[feature];
+    }
+    result = R_nc_protect (allocVector (VECSXP, 4));
+    SET_VECTOR_ELT (result, 0, featids);
+    SET_VECTOR_ELT (result, 1, offsets);
+    SET_VECTOR_ELT (result, 2, counts);
+    SET_VECTOR_ELT (result, 3, columns);
+  } else {
+    /* A table of samples for each feature */
+    result = R_nc_protect (allocVector (VECSXP, nsel));
+    for (isel=0; isel<nsel; isel++) {
+      mark = R_nc_mark_get ();
+      feature = INTEGER (featids)[isel] - 1;
+      frame = allocVector (VECSXP, nvar);
+      SET_VECTOR_ELT (result, isel, frame);
+      for (ivar=0; ivar<nvar; ivar++) {
+        SET_VECTOR_ELT (frame, ivar,
+          R_nc_ragged_slice (VECTOR_ELT (columns, ivar), foffset[isel],
+                             fcount[feature]));
+      }
+      R_nc_ragged_frame (frame, colnames, fcount[feature]);
+      /* Table is protected by the result, so temporary objects are released */
+      R_nc_release (mark);
+    }
+  }
+
+  RRETURN (result);
+}
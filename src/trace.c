@@ -0,0 +1,220 @@
+/*=============================================================================*\
+ *
+ *  Name:       trace.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Timeline tracing of RNetCDF native calls
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+#include "RNetCDF.h"
+
+
+/* Spans recorded while tracing is enabled.
+   Names are string literals, so only pointers are stored.
+ */
+typedef struct {
+  const char *name;
+  double start, dur;
+  int cat, depth, error;
+} R_nc_span;
+
+/* Labels of span categories, in the order of R_nc_trace_cat */
+static const char *R_nc_trace_cats[] = {"call", "attribute", "mode", "io",
+                                         "convert"};
+
+static R_nc_span *R_nc_spans = NULL;
+static size_t R_nc_nspan = 0, R_nc_maxspan = 0, R_nc_nlost = 0;
+static double R_nc_trace_origin = 0;
+
+/* Indices of open spans, innermost last */
+#define RNC_TRACE_MAXDEPTH 16
+static size_t R_nc_spanopen[RNC_TRACE_MAXDEPTH];
+static int R_nc_depth = 0;
+
+int R_nc_trace_on = 0;
+
+
+/* Close all open spans, marking them as terminated by an error */
+void
+R_nc_trace_unwind (void)
+{
+  double now;
+  size_t ispan;
+  if (R_nc_depth > 0) {
+    now = R_nc_timer () - R_nc_trace_origin;
+    while (R_nc_depth > 0) {
+      ispan = R_nc_spanopen[--R_nc_depth];
+      if (ispan < R_nc_nspan) {
+        R_nc_spans[ispan].dur = now - R_nc_spans[ispan].start;
+        R_nc_spans[ispan].error = 1;
+      }
+    }
+  }
+}
+
+
+int
+R_nc_trace_begin (const char *name, int cat)
+{
+  size_t ispan;
+
+  if (!R_nc_trace_on) {
+    return -1;
+  }
+
+  /* Entry points are never nested, so any open spans were left by an error
+     that did not pass through R_nc_error */
+  if (cat == RNC_TRACE_CALL) {
+    R_nc_trace_unwind ();
+  }
+
+  if (R_nc_depth >= RNC_TRACE_MAXDEPTH) {
+    return -1;
+  }
+
+  if (R_nc_nspan >= R_nc_maxspan) {
+    R_nc_nlost++;
+    ispan = R_nc_maxspan;
+  } else {
+    ispan = R_nc_nspan++;
+    R_nc_spans[ispan].name = name;
+    R_nc_spans[ispan].cat = cat;
+    R_nc_spans[ispan].depth = R_nc_depth;
+    R_nc_spans[ispan].error = 0;
+    R_nc_spans[ispan].dur = 0;
+    R_nc_spans[ispan].start = R_nc_timer () - R_nc_trace_origin;
+  }
+
+  R_nc_spanopen[R_nc_depth] = ispan;
+  return R_nc_depth++;
+}
+
+
+void
+R_nc_trace_end (int span)
+{
+  size_t ispan;
+  if (span < 0 || span >= R_nc_depth) {
+    return;
+  }
+  /* Close any inner spans that were not ended explicitly */
+  while (R_nc_depth > span) {
+    ispan = R_nc_spanopen[--R_nc_depth];
+    if (ispan < R_nc_nspan) {
+      R_nc_spans[ispan].dur = R_nc_timer () - R_nc_trace_origin -
+                              R_nc_spans[ispan].start;
+    }
+  }
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_trace_start()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_trace_start (SEXP maxspan)
+{
+  double dmax;
+
+  /*-- Check arguments --------------------------------------------------------*/
+  dmax = asReal (maxspan);
+  if (!R_FINITE (dmax) || dmax < 1) {
+    RERROR ("Maximum number of trace events must be positive");
+  }
+
+  /*-- Discard any previous trace and allocate a new buffer -------------------*/
+  R_nc_trace_on = 0;
+  R_Free (R_nc_spans);
+  R_nc_spans = R_Calloc ((size_t) dmax, R_nc_span);
+  R_nc_maxspan = dmax;
+  R_nc_nspan = 0;
+  R_nc_nlost = 0;
+  R_nc_depth = 0;
+  R_nc_trace_origin = R_nc_timer ();
+  R_nc_trace_on = 1;
+
+  RRETURN(R_NilValue);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_trace_stop()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_trace_stop (void)
+{
+  SEXP result, name, cat, start, dur, depth, error;
+  size_t ii;
+
+  /*-- Stop tracing -----------------------------------------------------------*/
+  R_nc_trace_unwind ();
+  R_nc_trace_on = 0;
+
+  /*-- Copy events to R vectors, with times in microseconds -------------------*/
+  name = R_nc_protect (allocVector (STRSXP, R_nc_nspan));
+  cat = R_nc_protect (allocVector (STRSXP, R_nc_nspan));
+  start = R_nc_protect (allocVector (REALSXP, R_nc_nspan));
+  dur = R_nc_protect (allocVector (REALSXP, R_nc_nspan));
+  depth = R_nc_protect (allocVector (INTSXP, R_nc_nspan));
+  error = R_nc_protect (allocVector (LGLSXP, R_nc_nspan));
+
+  for (ii=0; ii<R_nc_nspan; ii++) {
+    SET_STRING_ELT (name, ii, mkChar (R_nc_spans[ii].name));
+    SET_STRING_ELT (cat, ii, mkChar (R_nc_trace_cats[R_nc_spans[ii].cat]));
+    REAL (start)[ii] = 1.0e6 * R_nc_spans[ii].start;
+    REAL (dur)[ii] = 1.0e6 * R_nc_spans[ii].dur;
+    INTEGER (depth)[ii] = R_nc_spans[ii].depth;
+    LOGICAL (error)[ii] = R_nc_spans[ii].error;
+  }
+
+  /*-- Returning the list -----------------------------------------------------*/
+  result = R_nc_protect (allocVector (VECSXP, 7));
+  SET_VECTOR_ELT (result, 0, name);
+  SET_VECTOR_ELT (result, 1, cat);
+  SET_VECTOR_ELT (result, 2, start);
+  SET_VECTOR_ELT (result, 3, dur);
+  SET_VECTOR_ELT (result, 4, depth);
+  SET_VECTOR_ELT (result, 5, error);
+  SET_VECTOR_ELT (result, 6, ScalarReal (R_nc_nlost));
+
+  /*-- Free the trace buffer --------------------------------------------------*/
+  R_Free (R_nc_spans);
+  R_nc_nspan = 0;
+  R_nc_maxspan = 0;
+
+  RRETURN(result);
+}
+
@@ -226,6 +226,7 @@ R_nc_def_type (SEXP nc, SEXP typename, SEXP class, SEXP size, SEXP basetype,
 
   /*-- Decode arguments -------------------------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   typenamep = R_nc_strarg (typename);
 
@@ -269,6 +270,7 @@ R_nc_insert_type (SEXP nc, SEXP type, SEXP name, SEXP value,
 
   /*-- Decode arguments -------------------------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   R_nc_check (R_nc_type_id (type, ncid, &typeid, 0));
 
@@ -353,6 +355,7 @@ R_nc_inq_type (SEXP nc, SEXP type, SEXP fields)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
   R_nc_check (R_nc_type_id (type, ncid, &xtype, 0));
   extend = (asLogical (fields) == TRUE);
 
@@ -37,6 +37,7 @@
 #include <stdint.h>
 #include <limits.h>
 #include <float.h>
+#include <math.h>
 
 #include <R.h>
 #include <Rinternals.h>
@@ -58,29 +59,83 @@
  *  R_nc_def_var()
 \*-----------------------------------------------------------------------------*/
 
+/* Labels of quantization modes, indexed by netcdf mode */
+static const char *R_nc_quantize_modes[] = {NULL, "bitgroom", "granularbr",
+                                            "bitround"};
+
 SEXP
-R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims)
+R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims, SEXP quantize,
+              SEXP nsd, SEXP chunking, SEXP chunksizes, SEXP access)
 {
-  int ncid, ii, jj, *dimids, ndims, varid;
+  int ncid, ii, jj, *dimids, ndims, varid, qmode, qnsd, qmax, storage, iaccess,
+      format;
+  size_t *chunks;
   nc_type xtype;
-  const char *varnamep;
+  const char *varnamep, *qattname;
   SEXP result;
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   varnamep = R_nc_strarg (varname);
 
   R_nc_check (R_nc_type_id (type, ncid, &xtype, 0));
 
   ndims = length(dims);
-  dimids = (void *) R_alloc (ndims, sizeof(int));
+  dimids = (void *) R_nc_alloc (ndims, sizeof(int));
 
   for (ii=0, jj=ndims-1; ii<ndims; ii++, jj--) {
     /* Handle dimension names and convert from R to C storage order */
     R_nc_check (R_nc_dim_id (dims, ncid, &dimids[jj], ii));
   }
 
+  qmode = NC_QUANTIZE_NOQUANTIZE;
+  for (ii=NC_QUANTIZE_BITGROOM; ii<=NC_QUANTIZE_BITROUND; ii++) {
+    if (R_nc_strcmp (quantize, R_nc_quantize_modes[ii])) {
+      qmode = ii;
+    }
+  }
+  if (qmode == NC_QUANTIZE_NOQUANTIZE && isString (quantize)) {
+    RERROR ("Unknown quantization mode");
+  }
+  qnsd = asInteger (nsd);
+  if (qmode != NC_QUANTIZE_NOQUANTIZE && qnsd == NA_INTEGER) {
+    RERROR ("Number of significant digits or bits must be specified");
+  }
+
+  /* Storage is -1 for the library default, or NC_CONTIGUOUS or NC_CHUNKED */
+  chunks = NULL;
+  iaccess = -1;
+  if (isString (chunking)) {
+    if (!R_nc_strcmp (chunking, "auto")) {
+      RERROR ("Chunking must be logical or \"auto\"");
+    }
+    storage = NC_CHUNKED;
+    iaccess = R_nc_chunk_access (access);
+  } else {
+    ii = asLogical (chunking);
+    storage = (ii == NA_LOGICAL) ? -1 : (ii ? NC_CHUNKED : NC_CONTIGUOUS);
+  }
+  if (!isNull (chunksizes)) {
+    if (length (chunksizes) != ndims) {
+      RERROR ("Length of chunksizes must match number of dimensions");
+    }
+    chunks = R_nc_dim_r2c_size (chunksizes, ndims, 0);
+    if (storage == -1) {
+      storage = NC_CHUNKED;
+    }
+  }
+
+  /*-- Check options that need the netcdf4 storage format ---------------------*/
+  R_nc_check (nc_inq_format (ncid, &format));
+  if (format != NC_FORMAT_NETCDF4 && format != NC_FORMAT_NETCDF4_CLASSIC) {
+    if (qmode != NC_QUANTIZE_NOQUANTIZE) {
+      RERROR ("Quantization requires netcdf4 or classic4 format");
+    }
+    storage = -1;
+  }
+
   /*-- Enter define mode ------------------------------------------------------*/
   R_nc_check( R_nc_redef (ncid));
 
@@ -88,6 +143,46 @@ R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims)
   R_nc_check (nc_def_var (
             ncid, varnamep, xtype, ndims, dimids, &varid));
 
+  /*-- Set storage layout (netcdf4 only) -------------------------------------*/
+  if (storage == NC_CHUNKED && ndims > 0) {
+    if (!chunks && iaccess >= 0) {
+      chunks = (size_t *) R_nc_alloc (ndims, sizeof (size_t));
+      R_nc_chunk_auto (ncid, xtype, ndims, dimids, iaccess, RNC_CHUNK_TARGET,
+                       chunks);
+    }
+    R_nc_check (nc_def_var_chunking (ncid, varid, NC_CHUNKED, chunks));
+  } else if (storage == NC_CONTIGUOUS) {
+    R_nc_check (nc_def_var_chunking (ncid, varid, NC_CONTIGUOUS, NULL));
+  }
+
+  /*-- Set quantization of floating-point data --------------------------------*/
+  if (qmode != NC_QUANTIZE_NOQUANTIZE) {
+#if defined HAVE_DECL_NC_DEF_VAR_QUANTIZE && HAVE_DECL_NC_DEF_VAR_QUANTIZE
+    R_nc_check (nc_def_var_quantize (ncid, varid, qmode, qnsd));
+#else
+    /* Quantization is emulated by R_nc_put_var,
+       using the attribute defined by netcdf-4.9 */
+    if (xtype == NC_FLOAT) {
+      qmax = (qmode == NC_QUANTIZE_BITROUND) ? FLT_MANT_DIG-1 : FLT_DIG+1;
+    } else if (xtype == NC_DOUBLE) {
+      qmax = (qmode == NC_QUANTIZE_BITROUND) ? DBL_MANT_DIG-1 : DBL_DIG;
+    } else {
+      RERROR ("Quantization requires a floating-point type");
+    }
+    if (qnsd < 1 || qnsd > qmax) {
+      RERROR ("Number of significant digits or bits is out of range");
+    }
+    if (qmode == NC_QUANTIZE_BITGROOM) {
+      qattname = NC_QUANTIZE_BITGROOM_ATT_NAME;
+    } else if (qmode == NC_QUANTIZE_GRANULARBR) {
+      qattname = NC_QUANTIZE_GRANULARBR_ATT_NAME;
+    } else {
+      qattname = NC_QUANTIZE_BITROUND_ATT_NAME;
+    }
+    R_nc_check (nc_put_att_int (ncid, varid, qattname, NC_INT, 1, &qnsd));
+#endif
+  }
+
   result = R_nc_protect (ScalarInteger (varid));
   RRETURN(result);
 }
@@ -100,19 +195,19 @@ R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims)
 /* Macros to set **max or **min so that **fill is outside valid range */
 #define FILL2RANGE_REAL(TYPE, EPS) { \
   if (**(TYPE **) fill > (TYPE) 0) { \
-    *max = R_alloc (1, sizeof(TYPE)); \
+    *max = R_nc_alloc (1, sizeof(TYPE)); \
     **(TYPE **) max = **(TYPE **) fill * ((TYPE) 1 - (TYPE) 2 * (TYPE) EPS); \
   } else { \
-    *min = R_alloc (1, sizeof(TYPE)); \
+    *min = R_nc_alloc (1, sizeof(TYPE)); \
     **(TYPE **) min = **(TYPE **) fill * ((TYPE) 1 + (TYPE) 2 * (TYPE) EPS); \
   } \
 }
 #define FILL2RANGE_INT(TYPE) { \
   if (**(TYPE **) fill > (TYPE) 0) { \
-    *max = R_alloc (1, sizeof(TYPE)); \
+    *max = R_nc_alloc (1, sizeof(TYPE)); \
     **(TYPE **) max = **(TYPE **) fill - (TYPE) 1; \
   } else { \
-    *min = R_alloc (1, sizeof(TYPE)); \
+    *min = R_nc_alloc (1, sizeof(TYPE)); \
     **(TYPE **) min = **(TYPE **) fill + (TYPE) 1; \
   }; \
 }
@@ -129,7 +224,7 @@ R_nc_def_var (SEXP nc, SEXP varname, SEXP type, SEXP dims)
          http://www.unidata.ucar.edu/software/netcdf/docs/attribute_conventions.html
    Example: R_nc_miss_att (ncid, varid, mode, &fill, &min, &max);
   */
-static void
+void
 R_nc_miss_att (int ncid, int varid, int mode,
                void **fill, void **min, void **max)
 {
@@ -161,14 +256,14 @@ R_nc_miss_att (int ncid, int varid, int mode,
       nc_inq_att (ncid, varid, "_FillValue", &atype, &cnt) == NC_NOERR &&
       cnt == 1 &&
       atype == xtype) {
-    *fill = R_alloc (1, size);
+    *fill = R_nc_alloc (1, size);
     R_nc_check (nc_get_att (ncid, varid, "_FillValue", *fill));
 
   } else if ((mode == 0 || mode == 2) &&
       nc_inq_att (ncid, varid, "missing_value", &atype, &cnt) == NC_NOERR &&
       cnt == 1 &&
       atype == xtype) {
-    *fill = R_alloc (1, size);
+    *fill = R_nc_alloc (1, size);
     R_nc_check (nc_get_att (ncid, varid, "missing_value", *fill));
 
   } else if (mode == 3) {
@@ -186,7 +281,7 @@ R_nc_miss_att (int ncid, int varid, int mode,
        */
       if (nc_inq_att (ncid, varid, "valid_min", &atype, &cnt) == NC_NOERR &&
           cnt == 1) {
-        *min = R_alloc (1, 1);
+        *min = R_nc_alloc (1, 1);
         if (xtype == NC_UBYTE) {
           R_nc_check (nc_get_att_uchar (ncid, varid, "valid_min", *min));
         } else {
@@ -195,7 +290,7 @@ R_nc_miss_att (int ncid, int varid, int mode,
       }
       if (nc_inq_att (ncid, varid, "valid_max", &atype, &cnt) == NC_NOERR &&
           cnt == 1) {
-        *max = R_alloc (1, 1);
+        *max = R_nc_alloc (1, 1);
         if (xtype == NC_UBYTE) {
           R_nc_check (nc_get_att_uchar (ncid, varid, "valid_max", *max));
         } else {
@@ -205,7 +300,7 @@ R_nc_miss_att (int ncid, int varid, int mode,
       if (!*min && !*max &&
           nc_inq_att (ncid, varid, "valid_range", &atype, &cnt) == NC_NOERR &&
           cnt == 2) {
-        range = R_alloc (2, 1);
+        range = R_nc_alloc (2, 1);
         *min = range;
         *max = range + 1;
         if (xtype == NC_UBYTE) {
@@ -223,7 +318,7 @@ R_nc_miss_att (int ncid, int varid, int mode,
       if (nc_inq_att (ncid, varid, "_FillValue", &atype, &cnt) == NC_NOERR &&
           cnt == 1 &&
           atype == xtype) {
-        *fill = R_alloc (1, 1);
+        *fill = R_nc_alloc (1, 1);
         R_nc_check (nc_get_att (ncid, varid, "_FillValue", *fill));
       }
 
@@ -245,20 +340,20 @@ R_nc_miss_att (int ncid, int varid, int mode,
       if (nc_inq_att (ncid, varid, "valid_min", &atype, &cnt) == NC_NOERR &&
           cnt == 1 &&
           atype == xtype) {
-        *min = R_alloc (1, size);
+        *min = R_nc_alloc (1, size);
         R_nc_check (nc_get_att (ncid, varid, "valid_min", *min));
       }
       if (nc_inq_att (ncid, varid, "valid_max", &atype, &cnt) == NC_NOERR &&
           cnt == 1 &&
           atype == xtype) {
-        *max = R_alloc (1, size);
+        *max = R_nc_alloc (1, size);
         R_nc_check (nc_get_att (ncid, varid, "valid_max", *max));
       }
       if (!*min && !*max &&
           nc_inq_att (ncid, varid, "valid_range", &atype, &cnt) == NC_NOERR &&
           cnt == 2 &&
           atype == xtype) {
-        range = R_alloc (2, size);
+        range = R_nc_alloc (2, size);
         *min = range;
         *max = range + size;
         R_nc_check (nc_get_att (ncid, varid, "valid_range", range));
@@ -268,10 +363,10 @@ R_nc_miss_att (int ncid, int varid, int mode,
       if (nc_inq_att (ncid, varid, "_FillValue", &atype, &cnt) == NC_NOERR &&
           cnt == 1 &&
           atype == xtype) {
-        *fill = R_alloc (1, size);
+        *fill = R_nc_alloc (1, size);
         R_nc_check (nc_get_att (ncid, varid, "_FillValue", *fill));
       } else {
-        *fill = R_alloc (1, size);
+        *fill = R_nc_alloc (1, size);
         switch (xtype) {
           case NC_SHORT:
             **(short **) fill = NC_FILL_SHORT;
@@ -349,7 +444,7 @@ R_nc_miss_att (int ncid, int varid, int mode,
    On exit, either values are set or pointers are NULLed.
    Example: R_nc_pack_att (ncid, varid, scalep, addp);
   */
-static void
+void
 R_nc_pack_att (int ncid, int varid, double **scale, double **add)
 {
   size_t cnt;
@@ -366,6 +461,170 @@ R_nc_pack_att (int ncid, int varid, double **scale, double **add)
 }
 
 
+/* Find the quantization mode and number of significant digits (or bits)
+   of a netcdf variable. If quantization is not supported by the netcdf library,
+   the attributes used by RNetCDF to emulate quantization are read instead.
+   Example: R_nc_quantize_inq (ncid, varid, &mode, &nsd);
+  */
+void
+R_nc_quantize_inq (int ncid, int varid, int *mode, int *nsd)
+{
+#if defined HAVE_DECL_NC_DEF_VAR_QUANTIZE && HAVE_DECL_NC_DEF_VAR_QUANTIZE
+  if (nc_inq_var_quantize (ncid, varid, mode, nsd) != NC_NOERR) {
+    *mode = NC_QUANTIZE_NOQUANTIZE;
+  }
+#else
+  if (nc_get_att_int (ncid, varid, NC_QUANTIZE_BITGROOM_ATT_NAME, nsd) ==
+        NC_NOERR) {
+    *mode = NC_QUANTIZE_BITGROOM;
+  } else if (nc_get_att_int (ncid, varid, NC_QUANTIZE_GRANULARBR_ATT_NAME,
+               nsd) == NC_NOERR) {
+    *mode = NC_QUANTIZE_GRANULARBR;
+  } else if (nc_get_att_int (ncid, varid, NC_QUANTIZE_BITROUND_ATT_NAME,
+               nsd) == NC_NOERR) {
+    *mode = NC_QUANTIZE_BITROUND;
+  } else {
+    *mode = NC_QUANTIZE_NOQUANTIZE;
+  }
+#endif
+}
+
+
+/* Compute packing attributes that map the range of numeric data
+   to the range of an integer netcdf type, using the given number of bits.
+   Elements are scanned in one pass (in parallel if OpenMP is enabled),
+   ignoring missing and non-finite values.
+   The attributes scale_factor, add_offset and (if not defined) _FillValue
+   are written to the variable. Callers should read back the attributes
+   with R_nc_pack_att, so that data are packed with the stored values.
+   The packed range excludes the most negative value of a signed type
+   or the largest value of an unsigned type, which is used as _FillValue.
+   Example: R_nc_pack_auto (ncid, varid, data, cnt, bits, &scale, &add);
+  */
+static void
+R_nc_pack_auto (int ncid, int varid, SEXP data, size_t cnt, int bits,
+                double *scale, double *add)
+{
+  nc_type xtype, atype;
+  size_t size, ii;
+  int issigned;
+  double dmin=R_PosInf, dmax=R_NegInf, pmin, pmax, pfill, dval, *dp;
+  int imin=INT_MAX, imax=INT_MIN, ival, *ip;
+
+  /*-- Check the types of variable and data ----------------------------------*/
+  R_nc_check (nc_inq_vartype (ncid, varid, &xtype));
+  switch (xtype) {
+  case NC_BYTE:
+  case NC_SHORT:
+  case NC_INT:
+    issigned = 1;
+    break;
+  case NC_UBYTE:
+  case NC_USHORT:
+  case NC_UINT:
+    issigned = 0;
+    break;
+  default:
+    R_nc_error ("Automatic packing requires a variable of integer type");
+  }
+  R_nc_check (nc_inq_type (ncid, xtype, NULL, &size));
+
+  if (bits == NA_INTEGER) {
+    bits = 8 * size;
+  } else if (bits < 2 || bits > (int) (8 * size)) {
+    R_nc_error ("Number of bits for packing is invalid for type of variable");
+  }
+
+  if (!(isReal (data) || isInteger (data)) ||
+      R_nc_inherits (data, "integer64")) {
+    R_nc_error ("Automatic packing requires numeric data");
+  }
+  if ((size_t) xlength (data) < cnt) {
+    cnt = xlength (data);
+  }
+
+  /*-- Find the range of valid data -------------------------------------------*/
+  if (isReal (data)) {
+    dp = REAL (data);
+#ifdef _OPENMP
+#pragma omp parallel for private(dval) reduction(min:dmin) reduction(max:dmax)
+#endif
+    for (ii=0; ii<cnt; ii++) {
+      dval = dp[ii];
+      if (R_FINITE (dval)) {
+        if (dval < dmin) dmin = dval;
+        if (dval > dmax) dmax = dval;
+      }
+    }
+  } else {
+    ip = INTEGER (data);
+#ifdef _OPENMP
+#pragma omp parallel for private(ival) reduction(min:imin) reduction(max:imax)
+#endif
+    for (ii=0; ii<cnt; ii++) {
+      ival = ip[ii];
+      if (ival != NA_INTEGER) {
+        if (ival < imin) imin = ival;
+        if (ival > imax) imax = ival;
+      }
+    }
+    if (imin <= imax) {
+      dmin = imin;
+      dmax = imax;
+    }
+  }
+
+  /*-- Derive packing parameters ----------------------------------------------*/
+  if (issigned) {
+    pmax = ldexp (1.0, bits-1) - 1;
+    pmin = -pmax;
+    pfill = pmin - 1;
+  } else {
+    pmax = ldexp (1.0, bits) - 2;
+    pmin = 0;
+    pfill = pmax + 1;
+  }
+
+  if (dmin > dmax) {
+    /* No valid data */
+    *scale = 1;
+    *add = 0;
+  } else if (dmin == dmax) {
+    *scale = 1;
+    *add = dmin;
+  } else {
+    *scale = (dmax - dmin) / (pmax - pmin);
+    *add = dmin - pmin * (*scale);
+  }
+
+  /*-- Write attributes, keeping the type of any existing attributes ---------*/
+  R_nc_check (R_nc_redef (ncid));
+
+  if (nc_inq_atttype (ncid, varid, "scale_factor", &atype) != NC_NOERR ||
+      (atype != NC_FLOAT && atype != NC_DOUBLE)) {
+    atype = NC_DOUBLE;
+  }
+  R_nc_check (nc_put_att_double (ncid, varid, "scale_factor", atype, 1, scale));
+
+  if (nc_inq_atttype (ncid, varid, "add_offset", &atype) != NC_NOERR ||
+      (atype != NC_FLOAT && atype != NC_DOUBLE)) {
+    atype = NC_DOUBLE;
+  }
+  R_nc_check (nc_put_att_double (ncid, varid, "add_offset", atype, 1, add));
+
+  if (nc_inq_att (ncid, varid, "_FillValue", NULL, NULL) != NC_NOERR) {
+    R_nc_check (nc_put_att_double (ncid, varid, "_FillValue", xtype, 1,
+                                   &pfill));
+  } else {
+    R_nc_check (nc_get_att_double (ncid, varid, "_FillValue", &dval));
+    if (dval >= pmin && dval <= pmax) {
+      R_nc_error ("_FillValue is within the range of packed data");
+    }
+  }
+
+}
+
+
 /*-----------------------------------------------------------------------------*\
  *  R_nc_get_var()
 \*-----------------------------------------------------------------------------*/
@@ -375,16 +634,24 @@ R_nc_get_var (SEXP nc, SEXP var, SEXP start, SEXP count,
               SEXP rawchar, SEXP fitnum, SEXP namode, SEXP unpack)
 {
   int ncid, varid, ndims, ii, israw, isfit, inamode, isunpack;
-  size_t *cstart=NULL, *ccount=NULL;
+  size_t *cstart=NULL, *ccount=NULL, cnt, xsize;
   nc_type xtype;
   SEXP result=R_NilValue;
   void *buf;
   R_nc_buf io;
   double add, scale, *addp=NULL, *scalep=NULL;
   void *fillp=NULL, *minp=NULL, *maxp=NULL;
+  R_nc_handle *handle;
+  double alloc0, used0, time0, time1, time2;
+  int span, done;
+  char *key=NULL;
 
   /*-- Convert arguments ------------------------------------------------------*/
   ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+  alloc0 = R_nc_alloc_total;
+  used0 = R_nc_alloc_used;
+  R_nc_alloc_peak = used0;
 
   R_nc_check (R_nc_var_id (var, ncid, &varid));
 
@@ -405,7 +672,23 @@ R_nc_get_var (SEXP nc, SEXP var, SEXP start, SEXP count,
     }
   }
 
+  /*-- Return a cached result (if any) ----------------------------------------*/
+  if (handle && handle->readonly && !handle->image) {
+    key = R_nc_cache_key (ncid, varid, ndims, cstart, ccount,
+                          israw, isfit, inamode, isunpack);
+  }
+  if (key) {
+    span = R_nc_trace_begin ("R_nc_cache_get", RNC_TRACE_IO);
+    result = R_nc_cache_get (key);
+    R_nc_trace_end (span);
+    if (result != R_NilValue) {
+      handle->stats.get_calls++;
+      RRETURN (result);
+    }
+  }
+
   /*-- Get fill attributes (if any) -------------------------------------------*/
+  span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
   R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
 
   /*-- Get packing attributes (if any) ----------------------------------------*/
@@ -414,6 +697,7 @@ R_nc_get_var (SEXP nc, SEXP var, SEXP start, SEXP count,
     addp = &add;
     R_nc_pack_att (ncid, varid, &scalep, &addp);
   }
+  R_nc_trace_end (span);
 
   /*-- Enter data mode (if necessary) -----------------------------------------*/
   R_nc_check (R_nc_enddef (ncid));
@@ -422,10 +706,592 @@ R_nc_get_var (SEXP nc, SEXP var, SEXP start, SEXP count,
   buf = R_nc_c2r_init (&io, NULL, ncid, xtype, ndims, ccount,
                        israw, isfit, fillp, minp, maxp, scalep, addp);
 
-  if (R_nc_length (ndims, ccount) > 0) {
+  time0 = R_nc_timer ();
+  cnt = R_nc_length (ndims, ccount);
+  done = 0;
+  if (cnt > 0 && handle && handle->zarr) {
+    span = R_nc_trace_begin ("R_nc_zarr_get_vara", RNC_TRACE_IO);
+    done = R_nc_zarr_get_vara (ncid, varid, cstart, ccount, buf,
+                               handle->threads);
+    R_nc_trace_end (span);
+  }
+  if (cnt > 0 && !done) {
+    span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
     R_nc_check (nc_get_vara (ncid, varid, cstart, ccount, buf));
+    R_nc_trace_end (span);
   }
+  time1 = R_nc_timer ();
+  span = R_nc_trace_begin ("R_nc_c2r", RNC_TRACE_CONVERT);
   result = R_nc_c2r (&io);
+  R_nc_trace_end (span);
+  time2 = R_nc_timer ();
+
+  if (key) {
+    span = R_nc_trace_begin ("R_nc_cache_put", RNC_TRACE_IO);
+    R_nc_cache_put (key, result);
+    R_nc_trace_end (span);
+  }
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+    handle->stats.get_calls++;
+    handle->stats.get_bytes += (double) cnt * xsize;
+    handle->stats.io_time += time1 - time0;
+    handle->stats.convert_time += time2 - time1;
+    handle->stats.alloc_bytes += R_nc_alloc_total - alloc0;
+    if (R_nc_alloc_peak - used0 > handle->stats.peak_bytes) {
+      handle->stats.peak_bytes = R_nc_alloc_peak - used0;
+    }
+  }
+
+  RRETURN (result);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_get_vlen_flat()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_get_vlen_flat (SEXP nc, SEXP var, SEXP start, SEXP count,
+                    SEXP fitnum, SEXP namode, SEXP unpack)
+{
+  int ncid, varid, ndims, ii, class, isfit, inamode, isunpack, span;
+  size_t *cstart=NULL, *ccount=NULL, cnt, basesize;
+  nc_type xtype;
+  nc_vlen_t *vbuf;
+  double add, scale, *addp=NULL, *scalep=NULL;
+  void *fillp=NULL, *minp=NULL, *maxp=NULL;
+  R_nc_handle *handle;
+  double time0, time1, time2;
+  SEXP result;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+
+  R_nc_check (R_nc_var_id (var, ncid, &varid));
+
+  isfit = (asLogical (fitnum) == TRUE);
+  inamode = asInteger (namode);
+  isunpack = (asLogical (unpack) == TRUE);
+
+  /*-- Check that the variable has a vlen type --------------------------------*/
+  R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
+  class = NC_NAT;
+  if (xtype > NC_MAX_ATOMIC_TYPE) {
+    R_nc_check (nc_inq_user_type (ncid, xtype, NULL, NULL, NULL, NULL, &class));
+  }
+  if (class != NC_VLEN) {
+    RERROR ("Flat form is only available for vlen variables");
+  }
+  /* Base type is checked before reading, so that no elements are leaked */
+  R_nc_vlen_flat_base (ncid, xtype, &basesize);
+
+  /*-- Convert start and count from R to C indices ----------------------------*/
+  if (ndims > 0) {
+    cstart = R_nc_dim_r2c_size (start, ndims, 0);
+    ccount = R_nc_dim_r2c_size (count, ndims, 0);
+    for (ii=0; ii<ndims; ii++) {
+      cstart[ii] -= 1;
+    }
+  }
+
+  /*-- Get fill and packing attributes (if any) -------------------------------*/
+  span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
+  R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
+  if (isunpack) {
+    scalep = &scale;
+    addp = &add;
+    R_nc_pack_att (ncid, varid, &scalep, &addp);
+  }
+  R_nc_trace_end (span);
+
+  /*-- Enter data mode (if necessary) -----------------------------------------*/
+  R_nc_check (R_nc_enddef (ncid));
+
+  /*-- Read and convert all elements ------------------------------------------*/
+  cnt = R_nc_length (ndims, ccount);
+  vbuf = (nc_vlen_t *) R_nc_alloc (cnt, sizeof (nc_vlen_t));
+  time0 = R_nc_timer ();
+  if (cnt > 0) {
+    span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
+    R_nc_check (nc_get_vara (ncid, varid, cstart, ccount, vbuf));
+    R_nc_trace_end (span);
+  }
+  time1 = R_nc_timer ();
+  span = R_nc_trace_begin ("R_nc_vlen_flat_c2r", RNC_TRACE_CONVERT);
+  result = R_nc_vlen_flat_c2r (ncid, xtype, cnt, vbuf, isfit,
+                               fillp, minp, maxp, scalep, addp);
+  R_nc_trace_end (span);
+  time2 = R_nc_timer ();
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    handle->stats.get_calls++;
+    handle->stats.get_bytes += (double) cnt * sizeof (nc_vlen_t);
+    handle->stats.io_time += time1 - time0;
+    handle->stats.convert_time += time2 - time1;
+  }
+
+  RRETURN (result);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_get_sparse()
+\*-----------------------------------------------------------------------------*/
+
+/* Append elements of R vector rblk that are not missing to the vectors
+   of indices and values in list result, doubling their capacity as needed.
+ */
+#define R_NC_SPARSE_KEEP(TYPE, PTR, ISNA) \
+for (iblk=0; iblk<bcnt; iblk++) { \
+  if (!ISNA(((TYPE *) PTR (rblk))[iblk])) { \
+    if (nkeep == capacity) { \
+      capacity = (2*capacity < cnt) ? 2*capacity : cnt; \
+      SET_VECTOR_ELT (result, 0, \
+        xlengthgets (VECTOR_ELT (result, 0), capacity)); \
+      SET_VECTOR_ELT (result, 1, \
+        xlengthgets (VECTOR_ELT (result, 1), capacity)); \
+    } \
+    REAL (VECTOR_ELT (result, 0))[nkeep] = \
+      (double) (irow*rowcnt + iblk + 1); \
+    ((TYPE *) PTR (VECTOR_ELT (result, 1)))[nkeep] = \
+      ((TYPE *) PTR (rblk))[iblk]; \
+    nkeep++; \
+  } \
+}
+#define R_NC_SPARSE_ISNA_INT(value) (value==NA_INTEGER)
+#define R_NC_SPARSE_ISNA_REAL(value) (ISNAN(value))
+#define R_NC_SPARSE_ISNA_BIT64(value) (value==NA_INTEGER64)
+
+/* Read a numeric variable in blocks along the slowest dimension,
+   keeping only elements that are not missing after conversion to R.
+   Memory is needed for one block and the elements that are kept,
+   which are collected in vectors of increasing capacity.
+   Returns a protected list of 1-based linear indices within the slab
+   (double precision) and the corresponding values.
+ */
+SEXP
+R_nc_get_sparse (SEXP nc, SEXP var, SEXP start, SEXP count,
+                 SEXP fitnum, SEXP namode, SEXP unpack)
+{
+  int ncid, varid, ndims, ii, isfit, inamode, isunpack, span, isbit64;
+  size_t *cstart=NULL, *ccount=NULL, cnt, rowcnt, irow, nrow, maxrow,
+         iblk, nkeep, capacity, xsize, bcnt;
+  nc_type xtype;
+  void *buf;
+  R_nc_buf io;
+  R_nc_mark mark;
+  double add, scale, *addp=NULL, *scalep=NULL;
+  void *fillp=NULL, *minp=NULL, *maxp=NULL;
+  R_nc_handle *handle;
+  double time0, io_time=0, convert_time=0;
+  SEXP result, rblk;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+
+  R_nc_check (R_nc_var_id (var, ncid, &varid));
+
+  isfit = (asLogical (fitnum) == TRUE);
+  inamode = asInteger (namode);
+  isunpack = (asLogical (unpack) == TRUE);
+
+  /*-- Check that the variable has a numeric type -----------------------------*/
+  R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
+  if (xtype > NC_MAX_ATOMIC_TYPE || xtype == NC_CHAR || xtype == NC_STRING) {
+    RERROR ("Sparse form is only available for numeric variables");
+  }
+  R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+
+  /*-- Convert start and count from R to C indices ----------------------------*/
+  if (ndims > 0) {
+    cstart = R_nc_dim_r2c_size (start, ndims, 0);
+    ccount = R_nc_dim_r2c_size (count, ndims, 0);
+    for (ii=0; ii<ndims; ii++) {
+      cstart[ii] -= 1;
+    }
+  }
+
+  /*-- Get fill and packing attributes (if any) -------------------------------*/
+  span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
+  R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
+  if (isunpack) {
+    scalep = &scale;
+    addp = &add;
+    R_nc_pack_att (ncid, varid, &scalep, &addp);
+  }
+  R_nc_trace_end (span);
+
+  /*-- Enter data mode (if necessary) -----------------------------------------*/
+  R_nc_check (R_nc_enddef (ncid));
+
+  /* Results are kept in a protected list while they grow */
+  result = R_nc_protect (allocVector (VECSXP, 2));
+
+  /*-- Return empty results for an empty slab ---------------------------------*/
+  cnt = R_nc_length (ndims, ccount);
+  if (cnt == 0) {
+    /* Values have the same type as the conversion of a non-empty slab */
+    R_nc_c2r_init (&io, NULL, ncid, xtype, -1, &cnt,
+                   0, isfit, fillp, minp, maxp, scalep, addp);
+    SET_VECTOR_ELT (result, 0, allocVector (REALSXP, 0));
+    SET_VECTOR_ELT (result, 1, R_nc_c2r (&io));
+    RRETURN (result);
+  }
+
+  /*-- Find the number of records (slowest dimension) in each block -----------*/
+  if (ndims > 0) {
+    rowcnt = R_nc_length (ndims-1, ccount+1);
+    nrow = ccount[0];
+  } else {
+    rowcnt = 1;
+    nrow = 1;
+  }
+  if (rowcnt * xsize < RNC_GET_BLOCK) {
+    maxrow = RNC_GET_BLOCK / (rowcnt * xsize);
+  } else {
+    maxrow = 1;
+  }
+
+  capacity = 0;
+  nkeep = 0;
+  isbit64 = 0;
+
+  /*-- Read and filter each block ---------------------------------------------*/
+  for (irow=0; irow<nrow; irow+=maxrow) {
+    mark = R_nc_mark_get ();
+    if (ndims > 0) {
+      ccount[0] = (nrow - irow < maxrow) ? nrow - irow : maxrow;
+    }
+    bcnt = R_nc_length (ndims, ccount);
+    buf = R_nc_c2r_init (&io, NULL, ncid, xtype, -1, &bcnt,
+                         0, isfit, fillp, minp, maxp, scalep, addp);
+    time0 = R_nc_timer ();
+    span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
+    R_nc_check (nc_get_vara (ncid, varid, cstart, ccount, buf));
+    R_nc_trace_end (span);
+    io_time += R_nc_timer () - time0;
+
+    time0 = R_nc_timer ();
+    span = R_nc_trace_begin ("R_nc_c2r", RNC_TRACE_CONVERT);
+    rblk = R_nc_c2r (&io);
+    if (capacity == 0) {
+      /* Allocate results of the same type as the converted block */
+      isbit64 = R_nc_inherits (rblk, "integer64");
+      capacity = (cnt < 1024) ? cnt : 1024;
+      SET_VECTOR_ELT (result, 0, allocVector (REALSXP, capacity));
+      SET_VECTOR_ELT (result, 1, allocVector (TYPEOF (rblk), capacity));
+    }
+
+    if (TYPEOF (rblk) == INTSXP) {
+      R_NC_SPARSE_KEEP (int, INTEGER, R_NC_SPARSE_ISNA_INT);
+    } else if (isbit64) {
+      R_NC_SPARSE_KEEP (long long, REAL, R_NC_SPARSE_ISNA_BIT64);
+    } else {
+      R_NC_SPARSE_KEEP (double, REAL, R_NC_SPARSE_ISNA_REAL);
+    }
+    R_nc_trace_end (span);
+    convert_time += R_nc_timer () - time0;
+
+    if (ndims > 0) {
+      cstart[0] += ccount[0];
+    }
+    /* Results are protected by the list, so the block can be released */
+    R_nc_release (mark);
+  }
+
+  /*-- Trim results to the number of elements kept ----------------------------*/
+  if (nkeep < capacity) {
+    SET_VECTOR_ELT (result, 0, xlengthgets (VECTOR_ELT (result, 0), nkeep));
+    SET_VECTOR_ELT (result, 1, xlengthgets (VECTOR_ELT (result, 1), nkeep));
+  }
+  if (isbit64) {
+    classgets (VECTOR_ELT (result, 1), mkString ("integer64"));
+  }
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    handle->stats.get_calls++;
+    handle->stats.get_bytes += (double) cnt * xsize;
+    handle->stats.io_time += io_time;
+    handle->stats.convert_time += convert_time;
+  }
+
+  RRETURN (result);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_get_rec()
+\*-----------------------------------------------------------------------------*/
+
+/* Read a range of records from several variables that share the same
+   slowest-varying (record) dimension. In classic and 64-bit offset files,
+   record variables are interleaved record by record, so reading each variable
+   in turn would make a separate pass over the file.
+   Instead, the records are read in blocks containing about dblock bytes
+   from all variables, and each block is read from all variables before moving
+   to the next, so that each part of the file is read once.
+   The blocks are read directly into the C buffer of each variable,
+   which is converted to R after all blocks have been read.
+   Returns a protected list of R arrays.
+ */
+static SEXP
+R_nc_get_blocks (int ncid, R_nc_handle *handle, int nvar, const int *varid,
+                 size_t recstart, size_t reccount, int israw, int isfit,
+                 int inamode, int isunpack, double dblock)
+{
+  int ivar, *ndims, idim, recdim, dimids[NC_MAX_VAR_DIMS], span;
+  size_t irec, nblock, **cstart, **ccount, *recsize, recbytes, xsize, cnt;
+  nc_type xtype;
+  double add, scale, *addp, *scalep, time0, time1, time2;
+  double alloc0, used0;
+  void *fillp, *minp, *maxp;
+  char **buf;
+  R_nc_buf *io;
+  SEXP result;
+
+  alloc0 = R_nc_alloc_total;
+  used0 = R_nc_alloc_used;
+  R_nc_alloc_peak = used0;
+
+  /*-- Prepare to read each variable ------------------------------------------*/
+  ndims = (int *) R_nc_alloc (nvar, sizeof (int));
+  cstart = (size_t **) R_nc_alloc (nvar, sizeof (size_t *));
+  ccount = (size_t **) R_nc_alloc (nvar, sizeof (size_t *));
+  recsize = (size_t *) R_nc_alloc (nvar, sizeof (size_t));
+  buf = (char **) R_nc_alloc (nvar, sizeof (char *));
+  io = (R_nc_buf *) R_nc_alloc (nvar, sizeof (R_nc_buf));
+
+  recdim = -1;
+  recbytes = 0;
+  for (ivar=0; ivar<nvar; ivar++) {
+    R_nc_check (nc_inq_var (ncid, varid[ivar], NULL, &xtype, &(ndims[ivar]),
+                            dimids, NULL));
+    /* All variables must have the same record dimension */
+    if (ndims[ivar] < 1 || (recdim >= 0 && dimids[0] != recdim)) {
+      RERROR ("Variables must have the same record dimension");
+    }
+    recdim = dimids[0];
+
+    /* Read the record range and the full length of other dimensions */
+    cstart[ivar] = (size_t *) R_nc_alloc (ndims[ivar], sizeof (size_t));
+    ccount[ivar] = (size_t *) R_nc_alloc (ndims[ivar], sizeof (size_t));
+    cstart[ivar][0] = recstart;
+    ccount[ivar][0] = reccount;
+    for (idim=1; idim<ndims[ivar]; idim++) {
+      cstart[ivar][idim] = 0;
+      R_nc_check (nc_inq_dimlen (ncid, dimids[idim], &(ccount[ivar][idim])));
+    }
+    R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+    recsize[ivar] = xsize * R_nc_length (ndims[ivar]-1, ccount[ivar]+1);
+    recbytes += recsize[ivar];
+
+    /* Get fill and packing attributes (if any) */
+    span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
+    fillp = NULL;
+    minp = NULL;
+    maxp = NULL;
+    R_nc_miss_att (ncid, varid[ivar], inamode, &fillp, &minp, &maxp);
+    scalep = NULL;
+    addp = NULL;
+    if (isunpack) {
+      scalep = &scale;
+      addp = &add;
+      R_nc_pack_att (ncid, varid[ivar], &scalep, &addp);
+    }
+    R_nc_trace_end (span);
+
+    /* Allocate memory for the whole range of records */
+    buf[ivar] = R_nc_c2r_init (&(io[ivar]), NULL, ncid, xtype,
+                               ndims[ivar], ccount[ivar], israw, isfit,
+                               fillp, minp, maxp, scalep, addp);
+  }
+
+  /*-- Enter data mode (if necessary) -----------------------------------------*/
+  R_nc_check (R_nc_enddef (ncid));
+
+  /*-- Read blocks of records from all variables ------------------------------*/
+  if (recbytes > 0) {
+    nblock = dblock / recbytes;
+  } else {
+    nblock = reccount;
+  }
+  if (nblock < 1) {
+    nblock = 1;
+  }
+
+  time0 = R_nc_timer ();
+  span = R_nc_trace_begin ("nc_get_vara", RNC_TRACE_IO);
+  for (irec=0; irec<reccount; irec+=nblock) {
+    for (ivar=0; ivar<nvar; ivar++) {
+      cstart[ivar][0] = recstart + irec;
+      ccount[ivar][0] = (reccount - irec < nblock) ? (reccount - irec) : nblock;
+      if (R_nc_length (ndims[ivar], ccount[ivar]) > 0) {
+        R_nc_check (nc_get_vara (ncid, varid[ivar], cstart[ivar], ccount[ivar],
+                                 buf[ivar] + irec * recsize[ivar]));
+      }
+    }
+  }
+  R_nc_trace_end (span);
+  time1 = R_nc_timer ();
+
+  /*-- Convert all variables to R ---------------------------------------------*/
+  result = R_nc_protect (allocVector (VECSXP, nvar));
+  span = R_nc_trace_begin ("R_nc_c2r", RNC_TRACE_CONVERT);
+  for (ivar=0; ivar<nvar; ivar++) {
+    SET_VECTOR_ELT (result, ivar, R_nc_c2r (&(io[ivar])));
+  }
+  R_nc_trace_end (span);
+  time2 = R_nc_timer ();
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    cnt = 0;
+    for (ivar=0; ivar<nvar; ivar++) {
+      cnt += recsize[ivar] * reccount;
+    }
+    handle->stats.get_calls += nvar;
+    handle->stats.get_bytes += (double) cnt;
+    handle->stats.io_time += time1 - time0;
+    handle->stats.convert_time += time2 - time1;
+    handle->stats.alloc_bytes += R_nc_alloc_total - alloc0;
+    if (R_nc_alloc_peak - used0 > handle->stats.peak_bytes) {
+      handle->stats.peak_bytes = R_nc_alloc_peak - used0;
+    }
+  }
+
+  return result;
+}
+
+
+SEXP
+R_nc_get_rec (SEXP nc, SEXP varids, SEXP start, SEXP count,
+              SEXP rawchar, SEXP fitnum, SEXP namode, SEXP unpack,
+              SEXP blocksize)
+{
+  int ncid, nvar, ivar, *varid;
+  size_t recstart, reccount;
+  double dblock;
+  SEXP result;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+
+  nvar = length (varids);
+  recstart = R_nc_sizearg (start) - 1;
+  reccount = R_nc_sizearg (count);
+
+  dblock = asReal (blocksize);
+  if (!R_FINITE (dblock) || dblock < 1) {
+    RERROR ("Block size must be positive");
+  }
+
+  varid = (int *) R_nc_alloc (nvar, sizeof (int));
+  for (ivar=0; ivar<nvar; ivar++) {
+    R_nc_check (R_nc_var_id (VECTOR_ELT (varids, ivar), ncid, &(varid[ivar])));
+  }
+
+  /*-- Read blocks of records from all variables ------------------------------*/
+  result = R_nc_get_blocks (ncid, R_nc_handle_get (nc), nvar, varid,
+                            recstart, reccount,
+                            asLogical (rawchar) == TRUE,
+                            asLogical (fitnum) == TRUE,
+                            asInteger (namode),
+                            asLogical (unpack) == TRUE, dblock);
+
+  RRETURN (result);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_get_table()
+\*-----------------------------------------------------------------------------*/
+
+/* Read variables that are columns along one dimension into a data.frame.
+   Each variable must have the dimension as its slowest-varying dimension,
+   and no other dimension except the string length of NC_CHAR variables.
+   The columns are read by R_nc_get_blocks, so that records of
+   interleaved variables are read in a single pass,
+   and the converted arrays are used as columns without copying.
+ */
+SEXP
+R_nc_get_table (SEXP nc, SEXP dim, SEXP varids, SEXP start, SEXP count,
+                SEXP fitnum, SEXP namode, SEXP unpack, SEXP blocksize)
+{
+  int ncid, dimid, nvar, ivar, *varid, ndims, dimids[NC_MAX_VAR_DIMS];
+  size_t recstart, reccount, dimlen, irow;
+  double dblock;
+  nc_type xtype;
+  char varname[NC_MAX_NAME+1];
+  SEXP result, colnames, rownames, column;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  R_nc_check (R_nc_dim_id (dim, ncid, &dimid, 0));
+  R_nc_check (nc_inq_dimlen (ncid, dimid, &dimlen));
+
+  nvar = length (varids);
+  recstart = R_nc_sizearg (start) - 1;
+  reccount = R_nc_sizearg (count);
+  if (recstart > dimlen || reccount > dimlen - recstart) {
+    RERROR ("Rows exceed the length of the dimension");
+  }
+
+  dblock = asReal (blocksize);
+  if (!R_FINITE (dblock) || dblock < 1) {
+    RERROR ("Block size must be positive");
+  }
+
+  /*-- Check that each variable is a column of the dimension ------------------*/
+  varid = (int *) R_nc_alloc (nvar, sizeof (int));
+  colnames = R_nc_protect (allocVector (STRSXP, nvar));
+  for (ivar=0; ivar<nvar; ivar++) {
+    R_nc_check (R_nc_var_id (VECTOR_ELT (varids, ivar), ncid, &(varid[ivar])));
+    R_nc_check (nc_inq_var (ncid, varid[ivar], varname, &xtype, &ndims,
+                            dimids, NULL));
+    if (ndims != (xtype == NC_CHAR ? 2 : 1) || dimids[0] != dimid) {
+      RERROR ("Variables must be columns of the dimension");
+    }
+    SET_STRING_ELT (colnames, ivar, mkChar (varname));
+  }
+
+  /*-- Read the rows from all columns -----------------------------------------*/
+  result = R_nc_get_blocks (ncid, R_nc_handle_get (nc), nvar, varid,
+                            recstart, reccount, 0,
+                            asLogical (fitnum) == TRUE,
+                            asInteger (namode),
+                            asLogical (unpack) == TRUE, dblock);
+
+  /*-- Convert the list of columns to a data.frame ----------------------------*/
+  for (ivar=0; ivar<nvar; ivar++) {
+    column = VECTOR_ELT (result, ivar);
+    setAttrib (column, R_DimSymbol, R_NilValue);
+  }
+  setAttrib (result, R_NamesSymbol, colnames);
+
+  /* Rows are named by their indices in the dimension,
+     using the compact form of R for rows numbered from 1 */
+  if (reccount > INT_MAX || recstart + reccount > INT_MAX) {
+    RERROR ("Too many rows for a data.frame");
+  }
+  if (recstart > 0) {
+    rownames = R_nc_protect (allocVector (INTSXP, reccount));
+    for (irow=0; irow<reccount; irow++) {
+      INTEGER (rownames)[irow] = recstart + irow + 1;
+    }
+  } else {
+    rownames = R_nc_protect (allocVector (INTSXP, 2));
+    INTEGER (rownames)[0] = NA_INTEGER;
+    INTEGER (rownames)[1] = -((int) reccount);
+  }
+  setAttrib (result, R_RowNamesSymbol, rownames);
+  setAttrib (result, R_ClassSymbol, mkString ("data.frame"));
 
   RRETURN (result);
 }
@@ -438,13 +1304,14 @@ R_nc_get_var (SEXP nc, SEXP var, SEXP start, SEXP count,
 SEXP
 R_nc_inq_var (SEXP nc, SEXP var)
 {
-  int ncid, varid, ndims, natts, *dimids;
+  int ncid, varid, ndims, natts, *dimids, qmode, qnsd;
   char varname[NC_MAX_NAME + 1], vartype[NC_MAX_NAME+1];
   nc_type xtype;
   SEXP result, rdimids;
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   R_nc_check (R_nc_var_id (var, ncid, &varid));
 
@@ -465,14 +1332,24 @@ R_nc_inq_var (SEXP nc, SEXP var)
   /*-- Convert nc_type to char ------------------------------------------------*/
   R_nc_check (R_nc_type2str (ncid, xtype, vartype));
 
+  /*-- Inquire the quantization -----------------------------------------------*/
+  R_nc_quantize_inq (ncid, varid, &qmode, &qnsd);
+
   /*-- Construct the output list ----------------------------------------------*/
-  result = R_nc_protect (allocVector (VECSXP, 6));
+  result = R_nc_protect (allocVector (VECSXP, 8));
   SET_VECTOR_ELT (result, 0, ScalarInteger (varid));
   SET_VECTOR_ELT (result, 1, mkString (varname));
   SET_VECTOR_ELT (result, 2, mkString (vartype));
   SET_VECTOR_ELT (result, 3, ScalarInteger (ndims));
   SET_VECTOR_ELT (result, 4, rdimids);
   SET_VECTOR_ELT (result, 5, ScalarInteger (natts));
+  if (qmode != NC_QUANTIZE_NOQUANTIZE) {
+    SET_VECTOR_ELT (result, 6, mkString (R_nc_quantize_modes[qmode]));
+    SET_VECTOR_ELT (result, 7, ScalarInteger (qnsd));
+  } else {
+    SET_VECTOR_ELT (result, 6, ScalarString (NA_STRING));
+    SET_VECTOR_ELT (result, 7, ScalarInteger (NA_INTEGER));
+  }
 
   RRETURN(result);
 }
@@ -482,24 +1359,98 @@ R_nc_inq_var (SEXP nc, SEXP var)
  *  R_nc_put_var()
 \*-----------------------------------------------------------------------------*/
 
+/* Write a compound variable from an R list in blocks of records
+   (slowest dimension), so that the packed data in memory is limited to
+   about RNC_PUT_BLOCK bytes. Times taken by conversion and output are
+   added to *convtime and *iotime (seconds).
+   Result is 1 if data were written, or 0 if xtype is not a compound type.
+ */
+static int
+R_nc_put_compound (int ncid, int varid, nc_type xtype, int ndims,
+                   const size_t *cstart, const size_t *ccount, SEXP data,
+                   double *convtime, double *iotime)
+{
+  int class, span;
+  size_t size, rowcnt, irow, nrow, maxrow, *bstart, *bcount;
+  R_nc_packer *packer;
+  void *buf;
+  double time0, time1, time2;
+
+  if (xtype <= NC_MAX_ATOMIC_TYPE || TYPEOF (data) != VECSXP) {
+    return 0;
+  }
+  R_nc_check (nc_inq_user_type (ncid, xtype, NULL, &size, NULL, NULL, &class));
+  if (class != NC_COMPOUND) {
+    return 0;
+  }
+
+  time0 = R_nc_timer ();
+  span = R_nc_trace_begin ("R_nc_compound_packer", RNC_TRACE_CONVERT);
+  packer = R_nc_compound_packer (data, ncid, xtype, ndims, ccount);
+  R_nc_trace_end (span);
+  *convtime += R_nc_timer () - time0;
+
+  rowcnt = R_nc_length (ndims-1, ccount+1);
+  maxrow = (rowcnt * size < RNC_PUT_BLOCK) ? RNC_PUT_BLOCK / (rowcnt * size) : 1;
+  if (maxrow > ccount[0]) {
+    maxrow = ccount[0];
+  }
+
+  /* Gaps for alignment are never written by R_nc_compound_pack,
+     so the buffer is only zeroed once */
+  buf = R_nc_alloc (maxrow * rowcnt, size);
+  memset (buf, 0, maxrow * rowcnt * size);
+
+  bstart = (size_t *) R_nc_alloc (ndims, sizeof (size_t));
+  bcount = (size_t *) R_nc_alloc (ndims, sizeof (size_t));
+  memcpy (bstart, cstart, ndims * sizeof (size_t));
+  memcpy (bcount, ccount, ndims * sizeof (size_t));
+
+  for (irow=0; irow<ccount[0]; irow+=nrow) {
+    nrow = (ccount[0] - irow < maxrow) ? ccount[0] - irow : maxrow;
+    time1 = R_nc_timer ();
+    span = R_nc_trace_begin ("R_nc_compound_pack", RNC_TRACE_CONVERT);
+    R_nc_compound_pack (packer, irow * rowcnt, nrow * rowcnt, buf);
+    R_nc_trace_end (span);
+    time2 = R_nc_timer ();
+    *convtime += time2 - time1;
+    bstart[0] = cstart[0] + irow;
+    bcount[0] = nrow;
+    span = R_nc_trace_begin ("nc_put_vara", RNC_TRACE_IO);
+    R_nc_check (nc_put_vara (ncid, varid, bstart, bcount, buf));
+    R_nc_trace_end (span);
+    *iotime += R_nc_timer () - time2;
+  }
+  return 1;
+}
+
+
 SEXP
 R_nc_put_var (SEXP nc, SEXP var, SEXP start, SEXP count, SEXP data,
-              SEXP namode, SEXP pack)
+              SEXP namode, SEXP pack, SEXP bits)
 {
-  int ncid, varid, ndims, ii, inamode, ispack;
-  size_t *cstart=NULL, *ccount=NULL;
+  int ncid, varid, ndims, ii, inamode, ispack, ibits, qmode=0, qnsd;
+  size_t *cstart=NULL, *ccount=NULL, cnt, xsize;
   nc_type xtype;
   const void *buf;
   double scale, add, *scalep=NULL, *addp=NULL;
-  void *fillp=NULL, *minp=NULL, *maxp=NULL;
+  void *fillp=NULL, *minp=NULL, *maxp=NULL, *qbuf;
+  R_nc_handle *handle;
+  double alloc0, used0, time0, time1, time2, convtime=0, iotime=0;
+  int span, done;
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+  alloc0 = R_nc_alloc_total;
+  used0 = R_nc_alloc_used;
+  R_nc_alloc_peak = used0;
 
   R_nc_check (R_nc_var_id (var, ncid, &varid));
 
   inamode = asInteger (namode);
   ispack = (asLogical (pack) == TRUE);
+  ibits = asInteger (bits);
 
   /*-- Get type and rank of the variable --------------------------------------*/
   R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
@@ -513,7 +1464,17 @@ R_nc_put_var (SEXP nc, SEXP var, SEXP start, SEXP count, SEXP data,
     }
   }
 
+  /*-- Compute and write packing attributes (if requested) --------------------*/
+  if (R_nc_strcmp (pack, "auto")) {
+    span = R_nc_trace_begin ("R_nc_pack_auto", RNC_TRACE_CONVERT);
+    R_nc_pack_auto (ncid, varid, data, R_nc_length (ndims, ccount), ibits,
+                    &scale, &add);
+    R_nc_trace_end (span);
+    ispack = 1;
+  }
+
   /*-- Get fill attributes (if any) -------------------------------------------*/
+  span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
   R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
 
   /*-- Get packing attributes (if any) ----------------------------------------*/
@@ -523,13 +1484,146 @@ R_nc_put_var (SEXP nc, SEXP var, SEXP start, SEXP count, SEXP data,
     R_nc_pack_att (ncid, varid, &scalep, &addp);
   }
 
+#if !(defined HAVE_DECL_NC_DEF_VAR_QUANTIZE && HAVE_DECL_NC_DEF_VAR_QUANTIZE)
+  /*-- Get quantization attribute (if any) ------------------------------------*/
+  if (xtype == NC_FLOAT || xtype == NC_DOUBLE) {
+    R_nc_quantize_inq (ncid, varid, &qmode, &qnsd);
+  }
+#endif
+  R_nc_trace_end (span);
+
   /*-- Enter data mode (if necessary) -----------------------------------------*/
   R_nc_check (R_nc_enddef (ncid));
 
+  /*-- Write compound records in blocks (if possible) -------------------------*/
+  cnt = R_nc_length (ndims, ccount);
+  done = 0;
+  if (cnt > 0 && ndims > 0) {
+    done = R_nc_put_compound (ncid, varid, xtype, ndims, cstart, ccount, data,
+                              &convtime, &iotime);
+  }
+
   /*-- Write variable to file -------------------------------------------------*/
-  if (R_nc_length (ndims, ccount) > 0) {
+  if (cnt > 0 && !done) {
+    time0 = R_nc_timer ();
+    span = R_nc_trace_begin ("R_nc_r2c", RNC_TRACE_CONVERT);
     buf = R_nc_r2c (data, ncid, xtype, ndims, ccount, fillp, scalep, addp);
+    if (qmode != NC_QUANTIZE_NOQUANTIZE) {
+      /* Emulate quantization by the netcdf library,
+         without modifying R data passed through by R_nc_r2c */
+      if (isReal (data) && buf == REAL (data)) {
+        qbuf = R_nc_alloc (cnt, sizeof (double));
+        memcpy (qbuf, buf, cnt * sizeof (double));
+        buf = qbuf;
+      }
+      R_nc_quantize ((void *) buf, xtype, cnt, qmode, qnsd, fillp);
+    }
+    R_nc_trace_end (span);
+    time1 = R_nc_timer ();
+    span = R_nc_trace_begin ("nc_put_vara", RNC_TRACE_IO);
     R_nc_check (nc_put_vara (ncid, varid, cstart, ccount, buf));
+    R_nc_trace_end (span);
+    time2 = R_nc_timer ();
+    convtime = time1 - time0;
+    iotime = time2 - time1;
+  }
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+    handle->stats.put_calls++;
+    handle->stats.put_bytes += (double) cnt * xsize;
+    handle->stats.convert_time += convtime;
+    handle->stats.io_time += iotime;
+    handle->stats.alloc_bytes += R_nc_alloc_total - alloc0;
+    if (R_nc_alloc_peak - used0 > handle->stats.peak_bytes) {
+      handle->stats.peak_bytes = R_nc_alloc_peak - used0;
+    }
+  }
+
+  RRETURN (R_NilValue);
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  R_nc_put_vlen_flat()
+\*-----------------------------------------------------------------------------*/
+
+SEXP
+R_nc_put_vlen_flat (SEXP nc, SEXP var, SEXP start, SEXP count,
+                    SEXP values, SEXP offsets, SEXP namode, SEXP pack)
+{
+  int ncid, varid, ndims, ii, class, inamode, ispack, span;
+  size_t *cstart=NULL, *ccount=NULL, cnt;
+  nc_type xtype;
+  const nc_vlen_t *vbuf;
+  double scale, add, *scalep=NULL, *addp=NULL;
+  void *fillp=NULL, *minp=NULL, *maxp=NULL;
+  R_nc_handle *handle;
+  double time0, time1, time2;
+
+  /*-- Convert arguments ------------------------------------------------------*/
+  ncid = asInteger (nc);
+  handle = R_nc_handle_get (nc);
+
+  R_nc_check (R_nc_var_id (var, ncid, &varid));
+
+  inamode = asInteger (namode);
+  ispack = (asLogical (pack) == TRUE);
+
+  /*-- Check that the variable has a vlen type --------------------------------*/
+  R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
+  class = NC_NAT;
+  if (xtype > NC_MAX_ATOMIC_TYPE) {
+    R_nc_check (nc_inq_user_type (ncid, xtype, NULL, NULL, NULL, NULL, &class));
+  }
+  if (class != NC_VLEN) {
+    RERROR ("Flat form is only available for vlen variables");
+  }
+
+  /*-- Convert start and count from R to C indices ----------------------------*/
+  if (ndims > 0) {
+    cstart = R_nc_dim_r2c_size (start, ndims, 0);
+    ccount = R_nc_dim_r2c_size (count, ndims, 0);
+    for (ii=0; ii<ndims; ii++) {
+      cstart[ii] -= 1;
+    }
+  }
+
+  /*-- Get fill and packing attributes (if any) -------------------------------*/
+  span = R_nc_trace_begin ("attributes", RNC_TRACE_ATTR);
+  R_nc_miss_att (ncid, varid, inamode, &fillp, &minp, &maxp);
+  if (ispack) {
+    scalep = &scale;
+    addp = &add;
+    R_nc_pack_att (ncid, varid, &scalep, &addp);
+  }
+  R_nc_trace_end (span);
+
+  /*-- Enter data mode (if necessary) -----------------------------------------*/
+  R_nc_check (R_nc_enddef (ncid));
+
+  /*-- Convert all values and write variable to file --------------------------*/
+  cnt = R_nc_length (ndims, ccount);
+  time0 = R_nc_timer ();
+  span = R_nc_trace_begin ("R_nc_vlen_flat_r2c", RNC_TRACE_CONVERT);
+  vbuf = R_nc_vlen_flat_r2c (values, offsets, ncid, xtype, ndims, ccount,
+                             fillp, scalep, addp);
+  R_nc_trace_end (span);
+  time1 = R_nc_timer ();
+  if (cnt > 0) {
+    span = R_nc_trace_begin ("nc_put_vara", RNC_TRACE_IO);
+    R_nc_check (nc_put_vara (ncid, varid, cstart, ccount, vbuf));
+    R_nc_trace_end (span);
+  }
+  time2 = R_nc_timer ();
+
+  /*-- Update counters of the dataset -----------------------------------------*/
+  if (handle) {
+    handle->stats.put_calls++;
+    handle->stats.put_bytes += (double) cnt * sizeof (nc_vlen_t);
+    handle->stats.convert_time += time1 - time0;
+    handle->stats.io_time += time2 - time1;
   }
 
   RRETURN (R_NilValue);
@@ -548,6 +1642,7 @@ R_nc_rename_var (SEXP nc, SEXP var, SEXP newname)
 
   /*-- Convert arguments to netcdf ids ----------------------------------------*/
   ncid = asInteger (nc);
+  R_nc_stats_meta (nc);
 
   R_nc_check (R_nc_var_id (var, ncid, &varid));
 
@@ -0,0 +1,560 @@
+/*=============================================================================*\
+ *
+ *  Name:       zarr.c
+ *
+ *  Version:    2.0-1
+ *
+ *  Purpose:    Access to NCZarr stores in local directories
+ *
+ *  Author:     Pavel Michna (rnetcdf-devel@bluewin.ch)
+ *              Milton Woods (miltonjwoods@gmail.com)
+ *
+ *  Copyright:  (C) 2004-2017 Pavel Michna, Milton Woods
+ *
+ *=============================================================================*
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *=============================================================================*
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <netcdf.h>
+
+#include "common.h"
+
+
+/* Fragment of a URL that makes netcdf open a directory as an NCZarr store */
+#define RNC_ZARR_MODE "#mode=nczarr,file"
+
+/* Prefix of a URL for a local file */
+#define RNC_ZARR_SCHEME "file://"
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Paths of NCZarr stores
+\*-----------------------------------------------------------------------------*/
+
+int
+R_nc_zarr_isdir (const char *path)
+{
+  struct stat info;
+  return (strstr (path, "://") == NULL && strchr (path, '#') == NULL &&
+          stat (path, &info) == 0 && S_ISDIR (info.st_mode));
+}
+
+
+const char *
+R_nc_zarr_url (const char *path)
+{
+  char *url, *cwd=NULL;
+  size_t len;
+
+  /* URLs are passed to netcdf unchanged */
+  if (strstr (path, "://")) {
+    return path;
+  }
+
+  /* Relative paths are made absolute, because URLs have no working directory */
+  if (path[0] != '/' && !(isalpha (path[0]) && path[1] == ':')) {
+    cwd = R_nc_alloc (PATH_MAX + 1, 1);
+    if (!getcwd (cwd, PATH_MAX + 1)) {
+      R_nc_error ("Cannot find working directory");
+    }
+  }
+
+  len = strlen (RNC_ZARR_SCHEME) + strlen (path) + strlen (RNC_ZARR_MODE) + 3;
+  if (cwd) {
+    len += strlen (cwd);
+  }
+  url = R_nc_alloc (len, 1);
+  snprintf (url, len, "%s%s%s%s%s", RNC_ZARR_SCHEME,
+            (path[0] == '/' || cwd) ? "" : "/",
+            cwd ? cwd : "", cwd ? "/" : "", path);
+  strcat (url, RNC_ZARR_MODE);
+
+  return url;
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Metadata of Zarr arrays
+\*-----------------------------------------------------------------------------*/
+
+/* Properties of a Zarr (version 2) array that are needed to decode its chunks.
+   Arrays with other properties are read through the netcdf library.
+ */
+typedef struct {
+  int ndims;
+  size_t chunks[NC_MAX_VAR_DIMS];
+  size_t xsize; /* bytes per element */
+  int swap; /* 1 if byte order differs from the host */
+  int zlib; /* 1 if chunks are compressed by zlib */
+  char sep; /* separator of chunk indices in chunk keys */
+} R_nc_zarr_meta;
+
+
+/* Find the value of a key at any level of a JSON text.
+   Result is a pointer to the first character of the value, or NULL.
+   Keys used here are unique in the metadata of a Zarr array.
+ */
+static const char *
+R_nc_json_value (const char *json, const char *key)
+{
+  const char *pos;
+  size_t len;
+
+  len = strlen (key);
+  for (pos = strchr (json, '"'); pos; pos = strchr (pos + 1, '"')) {
+    if (strncmp (pos + 1, key, len) == 0 && pos[len + 1] == '"') {
+      pos += len + 2;
+      while (isspace (*pos)) pos++;
+      if (*pos != ':') {
+        continue;
+      }
+      pos++;
+      while (isspace (*pos)) pos++;
+      return pos;
+    }
+  }
+  return NULL;
+}
+
+
+/* Parse a JSON array of non-negative integers.
+   Result is the number of integers, or -1 if the value is not understood.
+ */
+static int
+R_nc_json_sizes (const char *value, size_t *sizes, int maxlen)
+{
+  int nval=0;
+  char *end;
+
+  if (!value || *value != '[') {
+    return -1;
+  }
+  value++;
+  while (1) {
+    while (isspace (*value)) value++;
+    if (*value == ']') {
+      return nval;
+    }
+    if (nval >= maxlen || !isdigit (*value)) {
+      return -1;
+    }
+    sizes[nval++] = strtoull (value, &end, 10);
+    value = end;
+    while (isspace (*value)) value++;
+    if (*value == ',') {
+      value++;
+    }
+  }
+}
+
+
+/* Read the whole of a small file into memory allocated by R_nc_alloc.
+   Result is NULL if the file cannot be read.
+ */
+static char *
+R_nc_zarr_slurp (const char *path)
+{
+  FILE *file;
+  long size;
+  char *text=NULL;
+
+  file = fopen (path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  if (fseek (file, 0, SEEK_END) == 0 && (size = ftell (file)) >= 0 &&
+      fseek (file, 0, SEEK_SET) == 0) {
+    text = R_nc_alloc (size + 1, 1);
+    if (fread (text, 1, size, file) == (size_t) size) {
+      text[size] = '\0';
+    } else {
+      text = NULL;
+    }
+  }
+  fclose (file);
+  return text;
+}
+
+
+/* Read the metadata of a Zarr array stored in directory key.
+   Returns 1 if the chunks can be decoded by R_nc_zarr_get_vara, 0 otherwise.
+ */
+static int
+R_nc_zarr_meta_get (const char *key, size_t xsize, int ndims,
+                    R_nc_zarr_meta *meta)
+{
+  char *path, *json;
+  const char *value;
+  size_t len, dsize;
+  int bigendian;
+  union {uint16_t word; unsigned char byte[2];} probe = {1};
+
+  len = strlen (key) + 9;
+  path = R_nc_alloc (len, 1);
+  snprintf (path, len, "%s/.zarray", key);
+  json = R_nc_zarr_slurp (path);
+  if (!json) {
+    return 0;
+  }
+
+  /* Shape of chunks */
+  meta->ndims = R_nc_json_sizes (R_nc_json_value (json, "chunks"),
+                                 meta->chunks, NC_MAX_VAR_DIMS);
+  if (meta->ndims != ndims) {
+    return 0;
+  }
+
+  /* Element type, such as "<f8" */
+  value = R_nc_json_value (json, "dtype");
+  if (!value || value[0] != '"' || !strchr ("<>|", value[1]) ||
+      !strchr ("biufS", value[2])) {
+    return 0;
+  }
+  dsize = strtoul (value + 3, NULL, 10);
+  if (dsize != xsize) {
+    return 0;
+  }
+  bigendian = (probe.byte[0] == 0);
+  meta->xsize = xsize;
+  meta->swap = (xsize > 1) && ((value[1] == '<' && bigendian) ||
+                               (value[1] == '>' && !bigendian));
+
+  /* Storage order */
+  value = R_nc_json_value (json, "order");
+  if (value && strncmp (value, "\"C\"", 3) != 0) {
+    return 0;
+  }
+
+  /* Filters other than the compressor are not supported */
+  value = R_nc_json_value (json, "filters");
+  if (value && strncmp (value, "null", 4) != 0 &&
+      strncmp (value, "[]", 2) != 0) {
+    return 0;
+  }
+
+  /* Compressor */
+  value = R_nc_json_value (json, "compressor");
+  if (!value || strncmp (value, "null", 4) == 0) {
+    meta->zlib = 0;
+  } else {
+#ifdef HAVE_LIBZ
+    value = R_nc_json_value (value, "id");
+    if (!value || strncmp (value, "\"zlib\"", 6) != 0) {
+      return 0;
+    }
+    meta->zlib = 1;
+#else
+    return 0;
+#endif
+  }
+
+  /* Separator of chunk indices in chunk keys */
+  value = R_nc_json_value (json, "dimension_separator");
+  if (!value || strncmp (value, "\".\"", 3) == 0) {
+    meta->sep = '.';
+  } else if (strncmp (value, "\"/\"", 3) == 0) {
+    meta->sep = '/';
+  } else {
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/* Find the directory of a variable in an NCZarr store.
+   Result is allocated by R_nc_alloc, or NULL if the store is not
+   a local directory.
+ */
+static char *
+R_nc_zarr_key (int ncid, int varid)
+{
+  char *url, *store, *grp, *key, varname[NC_MAX_NAME+1];
+  const char *frag;
+  size_t len, slen, glen;
+
+  /* Path of the store, from the URL used to open it */
+  R_nc_check (nc_inq_path (ncid, &len, NULL));
+  url = R_nc_alloc (len + 1, 1);
+  R_nc_check (nc_inq_path (ncid, NULL, url));
+  frag = strchr (url, '#');
+  if (strncmp (url, RNC_ZARR_SCHEME, strlen (RNC_ZARR_SCHEME)) != 0 ||
+      !frag || !strstr (frag, "file") || strstr (frag, "zip") ||
+      strstr (frag, "s3") || strchr (url, '%')) {
+    return NULL;
+  }
+  store = url + strlen (RNC_ZARR_SCHEME);
+  slen = frag - store;
+  while (slen > 0 && store[slen-1] == '/') {
+    slen--;
+  }
+
+  /* Path of the group and variable within the store */
+  R_nc_check (nc_inq_grpname_full (ncid, &glen, NULL));
+  grp = R_nc_alloc (glen + 1, 1);
+  R_nc_check (nc_inq_grpname_full (ncid, NULL, grp));
+  R_nc_check (nc_inq_varname (ncid, varid, varname));
+
+  len = slen + glen + strlen (varname) + 2;
+  key = R_nc_alloc (len, 1);
+  snprintf (key, len, "%.*s%s/%s", (int) slen, store,
+            (strcmp (grp, "/") == 0) ? "" : grp, varname);
+  return key;
+}
+
+
+/*-----------------------------------------------------------------------------*\
+ *  Reading of chunks
+\*-----------------------------------------------------------------------------*/
+
+/* Reverse the byte order of n elements of size xsize */
+static void
+R_nc_zarr_swap (unsigned char *buf, size_t n, size_t xsize)
+{
+  size_t ii, jj;
+  unsigned char tmp;
+  for (ii=0; ii<n; ii++, buf+=xsize) {
+    for (jj=0; jj<xsize/2; jj++) {
+      tmp = buf[jj];
+      buf[jj] = buf[xsize-1-jj];
+      buf[xsize-1-jj] = tmp;
+    }
+  }
+}
+
+
+/* Read and decode one chunk into buf, which has space for nbytes.
+   Returns 1 if the chunk was decoded, 0 if the chunk does not exist
+   (so it contains fill values), or -1 on error.
+   This function is called in parallel, so it must not use the R API.
+ */
+static int
+R_nc_zarr_chunk (const char *path, const R_nc_zarr_meta *meta,
+                 unsigned char *buf, size_t nbytes)
+{
+  FILE *file;
+  long size;
+  int status=-1;
+
+  file = fopen (path, "rb");
+  if (!file) {
+    return (errno == ENOENT) ? 0 : -1;
+  }
+  if (fseek (file, 0, SEEK_END) != 0 || (size = ftell (file)) < 0 ||
+      fseek (file, 0, SEEK_SET) != 0) {
+    fclose (file);
+    return -1;
+  }
+
+  if (!meta->zlib) {
+    if ((size_t) size == nbytes && fread (buf, 1, nbytes, file) == nbytes) {
+      status = 1;
+    }
+#ifdef HAVE_LIBZ
+  } else {
+    uLongf dlen = nbytes;
+    unsigned char *zbuf = malloc (size);
+    if (zbuf) {
+      if (fread (zbuf, 1, size, file) == (size_t) size &&
+          uncompress (buf, &dlen, zbuf, size) == Z_OK && dlen == nbytes) {
+        status = 1;
+      }
+      free (zbuf);
+    }
+#endif
+  }
+  fclose (file);
+
+  if (status == 1 && meta->swap) {
+    R_nc_zarr_swap (buf, nbytes / meta->xsize, meta->xsize);
+  }
+  return status;
+}
+
+
+int
+R_nc_zarr_get_vara (int ncid, int varid, const size_t *start,
+                    const size_t *count, void *data, int nthreads)
+{
+  int ndims, idim, failed=0, nofill;
+  nc_type xtype;
+  size_t xsize, c0[NC_MAX_VAR_DIMS], nc[NC_MAX_VAR_DIMS], nchunk, ichunk,
+         chunkbytes, keylen;
+  R_nc_zarr_meta meta;
+  char *key;
+  unsigned char *fill;
+
+  /*-- Check that chunks can be decoded here ----------------------------------*/
+  R_nc_check (nc_inq_var (ncid, varid, NULL, &xtype, &ndims, NULL, NULL));
+  if (ndims < 1 || xtype > NC_MAX_ATOMIC_TYPE || xtype == NC_STRING) {
+    return 0;
+  }
+  R_nc_check (nc_inq_type (ncid, xtype, NULL, &xsize));
+
+  key = R_nc_zarr_key (ncid, varid);
+  if (!key || !R_nc_zarr_meta_get (key, xsize, ndims, &meta)) {
+    return 0;
+  }
+  keylen = strlen (key);
+
+  fill = R_nc_alloc (1, xsize);
+  R_nc_check (nc_inq_var_fill (ncid, varid, &nofill, fill));
+
+  /*-- Find the range of chunks that overlap the slab -------------------------*/
+  nchunk = 1;
+  chunkbytes = xsize;
+  for (idim=0; idim<ndims; idim++) {
+    if (meta.chunks[idim] < 1) {
+      return 0;
+    }
+    c0[idim] = start[idim] / meta.chunks[idim];
+    nc[idim] = (start[idim] + count[idim] - 1) / meta.chunks[idim] -
+               c0[idim] + 1;
+    nchunk *= nc[idim];
+    chunkbytes *= meta.chunks[idim];
+  }
+
+  /*-- Decode chunks in parallel ----------------------------------------------*/
+  /* Each chunk is copied to a distinct part of the output,
+     so the chunks can be handled independently by any thread. */
+#ifdef _OPENMP
+  if (nthreads < 1) {
+    nthreads = omp_get_max_threads ();
+  }
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+#endif
+  for (ichunk=0; ichunk<nchunk; ichunk++) {
+    size_t cidx[NC_MAX_VAR_DIMS], lo[NC_MAX_VAR_DIMS], hi[NC_MAX_VAR_DIMS],
+           pos[NC_MAX_VAR_DIMS], rem, run, ii, offin, offout, pathlen;
+    int jdim, status, stop;
+    unsigned char *buf;
+    char *path, *end;
+
+    /* Flag is shared by all threads */
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+    stop = failed;
+    if (stop) {
+      continue;
+    }
+
+    /* Chunk indices and the part of the slab covered by this chunk */
+    rem = ichunk;
+    for (jdim=ndims-1; jdim>=0; jdim--) {
+      cidx[jdim] = c0[jdim] + rem % nc[jdim];
+      rem /= nc[jdim];
+      lo[jdim] = cidx[jdim] * meta.chunks[jdim];
+      hi[jdim] = lo[jdim] + meta.chunks[jdim];
+      if (lo[jdim] < start[jdim]) {
+        lo[jdim] = start[jdim];
+      }
+      if (hi[jdim] > start[jdim] + count[jdim]) {
+        hi[jdim] = start[jdim] + count[jdim];
+      }
+    }
+
+    /* Chunk key, such as "temp/0.3.1" */
+    pathlen = keylen + 2 + ndims * 21;
+    path = malloc (pathlen);
+    buf = malloc (chunkbytes);
+    if (!path || !buf) {
+      free (path);
+      free (buf);
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+      failed = 1;
+      continue;
+    }
+    end = path + sprintf (path, "%s/", key);
+    for (jdim=0; jdim<ndims; jdim++) {
+      if (jdim > 0) {
+        *(end++) = meta.sep;
+      }
+      end += sprintf (end, "%lu", (unsigned long) cidx[jdim]);
+    }
+
+    status = R_nc_zarr_chunk (path, &meta, buf, chunkbytes);
+    if (status < 0) {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+      failed = 1;
+    } else {
+      /* Copy rows of the fastest dimension from chunk (or fill) to output */
+      run = hi[ndims-1] - lo[ndims-1];
+      memcpy (pos, lo, ndims * sizeof (size_t));
+      while (pos[0] < hi[0]) {
+        offin = 0;
+        offout = 0;
+        for (jdim=0; jdim<ndims; jdim++) {
+          offin = offin * meta.chunks[jdim] +
+                  (pos[jdim] - cidx[jdim] * meta.chunks[jdim]);
+          offout = offout * count[jdim] + (pos[jdim] - start[jdim]);
+        }
+        if (status == 1) {
+          memcpy ((unsigned char *) data + offout * xsize,
+                  buf + offin * xsize, run * xsize);
+        } else {
+          for (ii=0; ii<run; ii++) {
+            memcpy ((unsigned char *) data + (offout + ii) * xsize, fill, xsize);
+          }
+        }
+        /* Advance to the next row */
+        for (jdim=ndims-2; jdim>=0; jdim--) {
+          if (++pos[jdim] < hi[jdim]) {
+            break;
+          }
+          pos[jdim] = lo[jdim];
+        }
+        if (jdim < 0) {
+          break;
+        }
+      }
+    }
+
+    free (path);
+    free (buf);
+  }
+
+  /* On failure, the caller reads the slab through the netcdf library */
+  return !failed;
+}